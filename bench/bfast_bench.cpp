@@ -0,0 +1,320 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Benchmarks for the C++ implementation, using Google Benchmark. Build with:
+        g++ -O2 -std=c++17 -I../include bfast_bench.cpp -o bfast_bench -pthread -lbenchmark
+
+    Each benchmark is run over a sweep of buffer counts (1 to 100k) and buffer sizes (64 B to 4 GB), limited to containers of at most
+    BFAST_BENCH_MAX_BYTES bytes (256 MB by default). Throughput is reported as bytes_per_second, and heap allocations as allocs_per_op.
+    For machine-readable output run with:
+        ./bfast_bench --benchmark_format=json --benchmark_out=bfast_bench.json
+
+    bench/csharp contains the same benchmarks for the C# BFast.ReadBFast and BFast.WriteBFast, with the same names and JSON output,
+    and compare.py prints the speedup of one set of results over the other.
+*/
+
+#include "bfast.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+
+using namespace std;
+
+// Counts the heap allocations, to report the allocations per operation. Every form of operator new is replaced, so that aligned
+// and array allocations are counted too, and each form of operator delete frees with the function its operator new allocated with.
+static atomic<size_t> num_allocations(0);
+
+static void* counted_alloc(size_t size) noexcept
+{
+    num_allocations.fetch_add(1, memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+}
+
+static void* counted_aligned_alloc(size_t size, align_val_t align) noexcept
+{
+    num_allocations.fetch_add(1, memory_order_relaxed);
+#ifdef _WIN32
+    return _aligned_malloc(size > 0 ? size : 1, (size_t)align);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, max((size_t)align, sizeof(void*)), size > 0 ? size : 1) == 0 ? p : nullptr;
+#endif
+}
+
+// The frees are not inlined into the callers of operator delete, where GCC would pair them with the call to operator new and
+// report a mismatch (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE static void counted_free(void* p) noexcept
+{
+    free(p);
+}
+
+BENCH_NOINLINE static void aligned_free(void* p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static void* throw_if_null(void* p)
+{
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return throw_if_null(counted_alloc(size)); }
+void* operator new[](size_t size) { return throw_if_null(counted_alloc(size)); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return counted_alloc(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return counted_alloc(size); }
+void* operator new(size_t size, align_val_t align) { return throw_if_null(counted_aligned_alloc(size, align)); }
+void* operator new[](size_t size, align_val_t align) { return throw_if_null(counted_aligned_alloc(size, align)); }
+void* operator new(size_t size, align_val_t align, const nothrow_t&) noexcept { return counted_aligned_alloc(size, align); }
+void* operator new[](size_t size, align_val_t align, const nothrow_t&) noexcept { return counted_aligned_alloc(size, align); }
+
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete[](p); }
+void operator delete(void* p, const nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { counted_free(p); }
+void operator delete(void* p, align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, align_val_t) noexcept { aligned_free(p); }
+void operator delete(void* p, size_t, align_val_t align) noexcept { operator delete(p, align); }
+void operator delete[](void* p, size_t, align_val_t align) noexcept { operator delete[](p, align); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { aligned_free(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { aligned_free(p); }
+
+// An output iterator adaptor over a byte pointer, standing in for a generic sink
+struct ByteOutIter
+{
+    typedef output_iterator_tag iterator_category;
+    typedef void value_type;
+    typedef void difference_type;
+    typedef void pointer;
+    typedef void reference;
+
+    bfast::byte* p;
+    ByteOutIter& operator*() { return *this; }
+    ByteOutIter& operator=(char c) { *p = (bfast::byte)c; return *this; }
+    ByteOutIter& operator=(bfast::byte c) { *p = c; return *this; }
+    ByteOutIter& operator++() { ++p; return *this; }
+    ByteOutIter operator++(int) { auto r = *this; ++p; return r; }
+};
+
+// The largest container that the sweep generates
+static size_t max_bytes()
+{
+    static const size_t r = []() {
+        auto s = getenv("BFAST_BENCH_MAX_BYTES");
+        return s != nullptr ? (size_t)strtoull(s, nullptr, 10) : (size_t)256 << 20;
+    }();
+    return r;
+}
+
+// Adds the arguments (number of buffers, buffer size) of the sweep
+static void sweep(benchmark::internal::Benchmark* b)
+{
+    for (long long count : { 1, 10, 100, 1000, 10000, 100000 })
+        for (long long size : { 64LL, 4LL << 10, 1LL << 20, 64LL << 20, 1LL << 30, 4LL << 30 })
+            if ((size_t)(count * size) <= max_bytes())
+                b->Args({ count, size });
+    b->ArgNames({ "buffers", "size" });
+}
+
+// A container of buffers filled with a pattern, with the names "buffer0", "buffer1" ...
+struct Fixture
+{
+    vector<vector<bfast::byte>> buffers;
+    bfast::BfastData data;
+    vector<bfast::byte> packed;
+
+    Fixture(size_t num_buffers, size_t buffer_size)
+        : buffers(num_buffers, vector<bfast::byte>(buffer_size, 1))
+    {
+        for (size_t i = 0; i < num_buffers; ++i)
+            data.add("buffer" + to_string(i), buffers[i].data(), buffers[i].data() + buffers[i].size());
+        packed = data.pack();
+    }
+
+    explicit Fixture(const benchmark::State& state)
+        : Fixture((size_t)state.range(0), (size_t)state.range(1))
+    { }
+};
+
+// Runs f once per iteration, and reports the throughput in bytes of the packed container, and the allocations per iteration
+template<typename F>
+static void run(benchmark::State& state, size_t bytes, F f)
+{
+    size_t allocations = 0;
+    for (auto _ : state) {
+        auto before = num_allocations.load(memory_order_relaxed);
+        f();
+        allocations += num_allocations.load(memory_order_relaxed) - before;
+    }
+    state.SetBytesProcessed((int64_t)(state.iterations() * bytes));
+    state.counters["allocs_per_op"] = benchmark::Counter((double)allocations, benchmark::Counter::kAvgIterations);
+}
+
+static void BM_Pack(benchmark::State& state)
+{
+    Fixture f(state);
+    run(state, f.packed.size(), [&]() { benchmark::DoNotOptimize(f.data.pack()); });
+}
+BENCHMARK(BM_Pack)->Apply(sweep);
+
+static void BM_PackParallel(benchmark::State& state)
+{
+    Fixture f(state);
+    run(state, f.packed.size(), [&]() { benchmark::DoNotOptimize(f.data.pack_parallel()); });
+}
+BENCHMARK(BM_PackParallel)->Apply(sweep)->UseRealTime();
+
+// Packs into uninitialized memory, with the page size given by the third argument
+static void BM_PackAligned(benchmark::State& state)
+{
+    Fixture f(state);
+    bfast::AllocationOptions options;
+    options.pages = (bfast::PageSize)state.range(2);
+    run(state, f.packed.size(), [&]() { benchmark::DoNotOptimize(f.data.pack_aligned(options)); });
+}
+BENCHMARK(BM_PackAligned)->Apply([](benchmark::internal::Benchmark* b) {
+    for (long long count : { 1, 100 })
+        for (long long size : { 1LL << 20, 64LL << 20 })
+            if ((size_t)(count * size) <= max_bytes())
+                for (long long pages : { bfast::pages_default, bfast::pages_transparent_huge, bfast::pages_huge_2mb })
+                    b->Args({ count, size, pages });
+    b->ArgNames({ "buffers", "size", "pages" });
+});
+
+static void BM_CopyTo(benchmark::State& state)
+{
+    Fixture f(state);
+    string name_data;
+    auto raw = f.data.to_raw_data(name_data);
+    vector<bfast::byte> out(raw.compute_needed_size());
+    run(state, out.size(), [&]() { raw.copy_to(out.data()); benchmark::ClobberMemory(); });
+}
+BENCHMARK(BM_CopyTo)->Apply(sweep);
+
+static void BM_CopyToLayout(benchmark::State& state)
+{
+    Fixture f(state);
+    string name_data;
+    auto raw = f.data.to_raw_data(name_data);
+    auto layout = raw.compute_layout();
+    vector<bfast::byte> out(layout.size());
+    run(state, out.size(), [&]() { raw.copy_to(out.data(), layout); benchmark::ClobberMemory(); });
+}
+BENCHMARK(BM_CopyToLayout)->Apply(sweep);
+
+static void BM_CopyToOutIter(benchmark::State& state)
+{
+    Fixture f(state);
+    string name_data;
+    auto raw = f.data.to_raw_data(name_data);
+    vector<bfast::byte> out(raw.compute_needed_size());
+    run(state, out.size(), [&]() { raw.copy_to(ByteOutIter{ out.data() }); benchmark::ClobberMemory(); });
+}
+BENCHMARK(BM_CopyToOutIter)->Apply(sweep);
+
+static void BM_Unpack(benchmark::State& state)
+{
+    Fixture f(state);
+    run(state, f.packed.size(), [&]() { benchmark::DoNotOptimize(bfast::BfastRawData::unpack(f.packed)); });
+}
+BENCHMARK(BM_Unpack)->Apply(sweep);
+
+// Creates a view and its name index, which is what opening a container in memory costs before the first lookup
+static void BM_View(benchmark::State& state)
+{
+    Fixture f(state);
+    run(state, f.packed.size(), [&]() {
+        bfast::BfastView view(f.packed.data(), f.packed.size());
+        benchmark::DoNotOptimize(view.name_index().size());
+    });
+}
+BENCHMARK(BM_View)->Apply(sweep);
+
+// Looks up every buffer by name in a view whose name index is already built
+static void BM_Find(benchmark::State& state)
+{
+    Fixture f(state);
+    bfast::BfastView view(f.packed.data(), f.packed.size());
+    vector<string> names;
+    for (size_t i = 0; i < view.num_buffers(); ++i)
+        names.push_back(string(view.name(i)));
+    size_t allocations = 0;
+    for (auto _ : state) {
+        auto before = num_allocations.load(memory_order_relaxed);
+        for (const auto& name : names)
+            benchmark::DoNotOptimize(view.find(name));
+        allocations += num_allocations.load(memory_order_relaxed) - before;
+    }
+    state.SetItemsProcessed((int64_t)(state.iterations() * names.size()));
+    state.counters["allocs_per_op"] = benchmark::Counter((double)allocations, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_Find)->Apply(sweep);
+
+static string bench_file_path()
+{
+    return "bfast_bench.tmp.bfast";
+}
+
+// Writes the container to a file, comparable to the C# WriteBFast to a file
+static void BM_WriteFile(benchmark::State& state)
+{
+    Fixture f(state);
+    auto path = bench_file_path();
+    run(state, f.packed.size(), [&]() { bfast::write_file(path, f.data); });
+    remove(path.c_str());
+}
+BENCHMARK(BM_WriteFile)->Apply(sweep)->UseRealTime();
+
+// Reads a file into memory and unpacks it, comparable to the C# ReadBFast from a file
+static void BM_ReadFile(benchmark::State& state)
+{
+    Fixture f(state);
+    auto path = bench_file_path();
+    bfast::write_file(path, f.data);
+    run(state, f.packed.size(), [&]() {
+        bfast::FileSource file(path);
+        vector<bfast::byte> bytes((size_t)file.size());
+        file.read(0, bytes.data(), bytes.size());
+        benchmark::DoNotOptimize(bfast::BfastRawData::unpack(bytes));
+    });
+    remove(path.c_str());
+}
+BENCHMARK(BM_ReadFile)->Apply(sweep)->UseRealTime();
+
+// Memory maps a file, builds the name index and touches the last buffer
+static void BM_OpenMapped(benchmark::State& state)
+{
+    Fixture f(state);
+    auto path = bench_file_path();
+    bfast::write_file(path, f.data);
+    run(state, f.packed.size(), [&]() {
+        auto view = bfast::open_mapped(path);
+        auto i = view.find("buffer" + to_string(view.num_buffers() - 1));
+        benchmark::DoNotOptimize(*view.buffer(i).begin());
+    });
+    remove(path.c_str());
+}
+BENCHMARK(BM_OpenMapped)->Apply(sweep)->UseRealTime();
+
+BENCHMARK_MAIN();
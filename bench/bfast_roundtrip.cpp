@@ -0,0 +1,356 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Round trips randomly shaped containers through every packing and reading path of the C++ implementation, checks that they
+    produce the same bytes and contents, and times each path. Build with:
+        g++ -O2 -std=c++17 -I../include bfast_roundtrip.cpp -o bfast_roundtrip -pthread
+
+    Usage:
+        bfast_roundtrip [--seed=<n>] [--containers=<n>] [--max-bytes=<n>] [--out=<directory>] [--json=<path>]
+
+    The containers are generated from the seed, with 0 to 2000 buffers of 0 bytes to 16 MB, random UTF-8 names and duplicate names,
+    and at most --max-bytes bytes each (64 MB by default). The exit code is 1 if any check fails.
+
+    With --out, the containers are also written to the directory along with manifest.txt, which has a line with the file and the number
+    of buffers of each container, followed by a line with the file, index, size, 32-bit FNV-1a hash and name of each of its buffers,
+    separated by tabs, so that the other readers can check them in turn:
+        node roundtrip.js <directory>                               The JavaScript parser, js/bfastParser.js
+        dotnet run -c Release -- --roundtrip=<directory>            The C# reader and writer, from bench/csharp
+
+    With --out, a byte swapped copy of each container is also read with BfastView and written to container<n>.swapped.bfast, which
+    isn't in the manifest but seeds the fuzz target. Each container is also written with a checksum table to a temporary file of
+    the directory and edited with BfastEditor, which must keep the checksums up to date.
+
+    With --json the timings are written in the format of Google Benchmark, so that two runs can be compared with compare.py.
+*/
+
+#include "bfast.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <random>
+
+using namespace std;
+
+// The total time and bytes of a path over all the containers
+struct Timing
+{
+    double seconds = 0;
+    size_t bytes = 0;
+    size_t iterations = 0;
+};
+
+static map<string, Timing> timings;
+static size_t failures = 0;
+
+// Runs f, and adds its time and the given number of bytes to the timing of the path
+template<typename F>
+static auto timed(const string& path, size_t bytes, F f)
+{
+    auto start = chrono::steady_clock::now();
+    struct Record {
+        const string& path;
+        size_t bytes;
+        chrono::steady_clock::time_point start;
+        ~Record() {
+            auto& t = timings[path];
+            t.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            t.bytes += bytes;
+            t.iterations++;
+        }
+    } record{ path, bytes, start };
+    return f();
+}
+
+static void check(bool condition, size_t container, const char* what)
+{
+    if (condition)
+        return;
+    fprintf(stderr, "container %zu: %s\n", container, what);
+    failures++;
+}
+
+// The 32-bit FNV-1a hash of a buffer, which is cheap to compute in every language
+static uint32_t fnv1a32(const bfast::byte* p, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// Returns a number from 0 to max inclusive, with a log-uniform distribution so that small values are as common as large ones
+static size_t log_uniform(mt19937_64& rng, size_t max)
+{
+    auto u = uniform_real_distribution<double>(0, log((double)max + 1))(rng);
+    return min(max, (size_t)exp(u) - 1);
+}
+
+// A random name of up to 40 characters, some of which take several bytes in UTF-8
+static string random_name(mt19937_64& rng)
+{
+    static const char* const alphabet[] = { "a", "b", "z", "0", "9", "_", ":", ".", "/", " ", "\xc3\xa9", "\xd0\xb6", "\xe6\xbc\xa2", "\xf0\x9f\x99\x82" };
+    string r;
+    for (size_t n = log_uniform(rng, 40); n > 0; --n)
+        r += alphabet[rng() % size(alphabet)];
+    return r;
+}
+
+// The buffers of a random container
+struct Container
+{
+    vector<string> names;
+    vector<vector<bfast::byte>> buffers;
+    bfast::BfastData data;
+
+    Container(mt19937_64& rng, size_t max_bytes)
+    {
+        auto count = log_uniform(rng, 2000);
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            auto size = log_uniform(rng, rng() % 50 == 0 ? (size_t)16 << 20 : (size_t)1 << 20);
+            if (total + size > max_bytes)
+                break;
+            total += size;
+            names.push_back(!names.empty() && rng() % 10 == 0 ? names[rng() % names.size()] : random_name(rng));
+            buffers.emplace_back(size);
+            auto& b = buffers.back();
+            for (size_t j = 0; j < size; j += 8) {
+                auto x = rng();
+                memcpy(b.data() + j, &x, min((size_t)8, size - j));
+            }
+        }
+        for (size_t i = 0; i < buffers.size(); ++i)
+            data.add(names[i], buffers[i].data(), buffers[i].data() + buffers[i].size());
+    }
+};
+
+// Checks that the ranges read back from a container are the names and buffers it was made of
+static void check_contents(const Container& c, size_t container, const char* path, const vector<string_view>& names,
+    const vector<bfast::ByteRange>& buffers)
+{
+    if (names.size() != c.buffers.size() || buffers.size() != c.buffers.size()) {
+        check(false, container, (string(path) + ": wrong number of buffers").c_str());
+        return;
+    }
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        const auto& b = c.buffers[i];
+        auto same = buffers[i].size() == b.size() && (b.empty() || memcmp(buffers[i].begin(), b.data(), b.size()) == 0);
+        check(names[i] == c.names[i], container, (string(path) + ": wrong name").c_str());
+        check(same, container, (string(path) + ": wrong buffer contents").c_str());
+    }
+}
+
+// Returns a copy of a byte stream as written by a machine of the other byte order: the header and the array offsets are swapped,
+// and the buffers, which are bytes, are the same
+static vector<bfast::byte> swapped_copy(const vector<bfast::byte>& packed)
+{
+    auto r = packed;
+    bfast::Header h;
+    memcpy(&h, r.data(), sizeof(h));
+    bfast::byte_swap<sizeof(bfast::ulong)>(r.data(), r.data(), sizeof(bfast::Header) / sizeof(bfast::ulong));
+    bfast::byte_swap<sizeof(bfast::ulong)>(r.data() + bfast::array_offsets_start, r.data() + bfast::array_offsets_start, (size_t)h.num_arrays * 2);
+    return r;
+}
+
+// Writes the container with a checksum table, edits it in place, and checks that the checksums still match the edited buffers
+static void check_edit(const Container& c, size_t container, const string& path)
+{
+    auto data = c.data;
+    data.reserved_arrays = 1;
+    auto packed = data.pack_with_checksums();
+    auto file = fopen(path.c_str(), "wb");
+    if (file == nullptr || fwrite(packed.data(), 1, packed.size(), file) != packed.size())
+        throw runtime_error("could not write " + path);
+    fclose(file);
+
+    // Until commit(), a reader of the file sees the original container, with checksums that match
+    auto check_original = [&](const char* what) {
+        auto view = bfast::open_mapped(path);
+        check(view.size >= packed.size() && memcmp(view.data, packed.data(), packed.size()) == 0, container, what);
+        check(view.verify_all(), container, what);
+    };
+
+    auto buffers = c.buffers;
+    auto names = c.names;
+    timed("RT_Edit", packed.size(), [&]() {
+        bfast::BfastEditor editor(path);
+        buffers.emplace_back(1000, 3);
+        names.push_back("added");
+        check(editor.add(names.back(), buffers.back().data(), buffers.back().size()) + 1 == buffers.size(), container,
+            "edit: add returned the wrong index");
+        check_original("edit: add changed the container before commit");
+        if (buffers.size() > 1) {
+            // The last buffer grows so that it moves to the end of the file, and the first one is rewritten in place
+            auto& last = buffers[buffers.size() - 2];
+            last.resize(last.size() + 100, 7);
+            editor.replace(buffers.size() - 2, last.data(), last.size());
+            check_original("edit: replacing a buffer out of place changed the container before commit");
+            reverse(buffers.front().begin(), buffers.front().end());
+            editor.replace(0, buffers.front().data(), buffers.front().size());
+        }
+        editor.commit();
+        return 0;
+    });
+
+    auto view = bfast::open_mapped(path);
+    check(bfast::validate(view.data, view.size, false).ok(), container, "edit: the container is not valid");
+    check(view.has_checksums() && view.num_buffers() == buffers.size() + 1, container, "edit: the checksum table is not the last buffer");
+    check(view.verify_all(), container, "edit: the checksums don't match the edited buffers");
+    for (size_t i = 0; i < buffers.size() && i < view.num_buffers(); ++i) {
+        auto b = view.buffer(i);
+        check(view.name(i) == names[i], container, "edit: wrong name");
+        check(b.size() == buffers[i].size() && (b.size() == 0 || memcmp(b.begin(), buffers[i].data(), b.size()) == 0), container,
+            "edit: wrong buffer contents");
+    }
+    view = bfast::BfastView();
+    remove(path.c_str());
+}
+
+static void round_trip(Container& c, size_t container, const string& out)
+{
+    auto& data = c.data;
+    string name_data;
+    auto raw = data.to_raw_data(name_data);
+    auto size = raw.compute_needed_size();
+
+    auto packed = timed("RT_Pack", size, [&]() { return data.pack(); });
+    check(packed.size() == size, container, "pack: the size is not compute_needed_size()");
+    check(bfast::validate(packed.data(), packed.size()).ok(), container, "pack: the container is not valid");
+
+    auto parallel = timed("RT_PackParallel", packed.size(), [&]() { return data.pack_parallel(); });
+    check(parallel == packed, container, "pack_parallel: different bytes than pack");
+
+    vector<bfast::byte> generic;
+    generic.reserve(packed.size());
+    timed("RT_CopyToOutIter", packed.size(), [&]() { raw.copy_to(back_inserter(generic)); return 0; });
+    check(generic == packed, container, "copy_to an output iterator: different bytes than pack");
+
+    auto unpacked = timed("RT_Unpack", packed.size(), [&]() { return bfast::BfastRawData::unpack(packed); });
+    auto buffers = vector<bfast::ByteRange>(unpacked.ranges.begin() + min((size_t)1, unpacked.ranges.size()), unpacked.ranges.end());
+    auto data_unpacked = bfast::BfastData::unpack(packed);
+    vector<string_view> names;
+    for (const auto& b : data_unpacked.buffers)
+        names.push_back(b.name);
+    check_contents(c, container, "unpack", names, buffers);
+
+    auto view = timed("RT_View", packed.size(), [&]() {
+        bfast::BfastView r(packed.data(), packed.size());
+        r.name_index();
+        return r;
+    });
+    names.clear();
+    buffers.clear();
+    for (size_t i = 0; i < view.num_buffers(); ++i) {
+        names.push_back(view.name(i));
+        buffers.push_back(view.buffer(i));
+        check(view.name(view.find(names.back())) == names.back(), container, "view: find returned a buffer with a different name");
+    }
+    check_contents(c, container, "view", names, buffers);
+
+    if (!out.empty()) {
+        auto path = out + "/container" + std::to_string(container) + ".bfast";
+        timed("RT_WriteFile", packed.size(), [&]() { bfast::write_file(path, data); return 0; });
+        auto mapped = timed("RT_OpenMapped", packed.size(), [&]() { return bfast::open_mapped(path); });
+        check(mapped.size == packed.size() && memcmp(mapped.data, packed.data(), packed.size()) == 0, container,
+            "write_file: different bytes than pack");
+        check_edit(c, container, out + "/edit" + std::to_string(container) + ".bfast");
+
+        // The byte swapped copy is kept in the directory as a seed for the fuzz target, but isn't in the manifest
+        auto swapped = swapped_copy(packed);
+        check(bfast::validate(swapped.data(), swapped.size()).ok(), container, "swapped: the container is not valid");
+        bfast::BfastView swapped_view(swapped.data(), swapped.size());
+        check(swapped_view.swapped(), container, "swapped: the view didn't detect the byte order");
+        names.clear();
+        buffers.clear();
+        for (size_t i = 0; i < swapped_view.num_buffers(); ++i) {
+            names.push_back(swapped_view.name(i));
+            buffers.push_back(swapped_view.buffer(i));
+        }
+        check_contents(c, container, "swapped view", names, buffers);
+        auto swapped_path = out + "/container" + std::to_string(container) + ".swapped.bfast";
+        auto file = fopen(swapped_path.c_str(), "wb");
+        if (file == nullptr || fwrite(swapped.data(), 1, swapped.size(), file) != swapped.size())
+            throw runtime_error("could not write " + swapped_path);
+        fclose(file);
+    }
+}
+
+static string option(int argc, char** argv, const string& name, const string& default_value)
+{
+    auto prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i)
+        if (string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return argv[i] + prefix.size();
+    return default_value;
+}
+
+static void write_json(const string& path)
+{
+    auto file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+        throw runtime_error("could not open " + path);
+    fprintf(file, "{\n  \"context\": { \"library\": \"bfast.h\" },\n  \"benchmarks\": [\n");
+    size_t i = 0;
+    for (const auto& t : timings) {
+        fprintf(file, "    { \"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %zu, \"real_time\": %f, \"cpu_time\": %f, \"time_unit\": \"ns\", \"bytes_per_second\": %f }%s\n",
+            t.first.c_str(), t.second.iterations, t.second.seconds / t.second.iterations * 1e9, t.second.seconds / t.second.iterations * 1e9,
+            t.second.bytes / t.second.seconds, ++i < timings.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        auto seed = strtoull(option(argc, argv, "seed", "1").c_str(), nullptr, 10);
+        auto containers = (size_t)strtoull(option(argc, argv, "containers", "100").c_str(), nullptr, 10);
+        auto max_bytes = (size_t)strtoull(option(argc, argv, "max-bytes", to_string((size_t)64 << 20)).c_str(), nullptr, 10);
+        auto out = option(argc, argv, "out", "");
+        auto json = option(argc, argv, "json", "");
+
+        FILE* manifest = nullptr;
+        if (!out.empty()) {
+            manifest = fopen((out + "/manifest.txt").c_str(), "w");
+            if (manifest == nullptr)
+                throw runtime_error("could not create " + out + "/manifest.txt");
+        }
+
+        mt19937_64 rng(seed);
+        size_t total_buffers = 0;
+        for (size_t i = 0; i < containers; ++i) {
+            Container c(rng, max_bytes);
+            round_trip(c, i, out);
+            total_buffers += c.buffers.size();
+            if (manifest == nullptr)
+                continue;
+            fprintf(manifest, "container%zu.bfast\t%zu\n", i, c.buffers.size());
+            for (size_t b = 0; b < c.buffers.size(); ++b)
+                fprintf(manifest, "container%zu.bfast\t%zu\t%zu\t%08x\t%s\n", i, b, c.buffers[b].size(),
+                    fnv1a32(c.buffers[b].data(), c.buffers[b].size()), c.names[b].c_str());
+        }
+        if (manifest != nullptr)
+            fclose(manifest);
+
+        printf("%-24s %12s %10s\n", "path", "ms", "GB/s");
+        for (const auto& t : timings)
+            printf("%-24s %12.3f %10.3f\n", t.first.c_str(), t.second.seconds * 1e3, t.second.bytes / t.second.seconds / 1e9);
+        if (!json.empty())
+            write_json(json);
+        printf("%zu containers, %zu buffers, %zu failures\n", containers, total_buffers, failures);
+        return failures > 0 ? 1 : 0;
+    }
+    catch (const exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,23 @@
+#!/usr/bin/env python3
+# Compares two Google Benchmark JSON outputs, such as the C++ and the C# benchmarks, and prints the speedup of the first over the second.
+#     python3 compare.py bfast_bench.json csharp/bfast_bench_csharp.json
+
+import json
+import sys
+
+def load(path):
+    with open(path) as f:
+        return { b["name"]: b for b in json.load(f)["benchmarks"] if b.get("run_type", "iteration") == "iteration" }
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: compare.py <first.json> <second.json>")
+    first, second = load(sys.argv[1]), load(sys.argv[2])
+    print("%-56s %14s %14s %9s" % ("benchmark", "first GB/s", "second GB/s", "speedup"))
+    for name in sorted(first.keys() & second.keys()):
+        a = first[name].get("bytes_per_second", 0) / 1e9
+        b = second[name].get("bytes_per_second", 0) / 1e9
+        print("%-56s %14.3f %14.3f %8.2fx" % (name, a, b, a / b if b > 0 else float("inf")))
+
+if __name__ == "__main__":
+    main()
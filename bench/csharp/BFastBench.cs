@@ -0,0 +1,200 @@
+/*
+    BFAST - Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Benchmarks of the C# BFast.ReadBFast and BFast.WriteBFast, over the same sweep of containers as bench/bfast_bench.cpp,
+    and with the same benchmark names, so that the results can be compared with bench/compare.py. Run with:
+        dotnet run -c Release -- --benchmark_out=bfast_bench_csharp.json
+
+    With --roundtrip=<directory>, the containers written by bench/bfast_roundtrip.cpp are checked instead: each is read with ReadBFast
+    and compared with the manifest, and written again with WriteBFastToBytes, which must produce the same bytes as the C++ writer.
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using Vim.BFast;
+
+namespace Vim.BFast.Bench
+{
+    public static class BFastBench
+    {
+        class Result
+        {
+            public string Name;
+            public long Iterations;
+            public double Seconds;
+            public long Bytes;
+            public long AllocatedBytes;
+        }
+
+        // The largest container that the sweep generates, the same environment variable as the C++ benchmarks
+        static long MaxBytes()
+        {
+            var s = Environment.GetEnvironmentVariable("BFAST_BENCH_MAX_BYTES");
+            return s != null ? long.Parse(s) : 256L << 20;
+        }
+
+        // The number of buffers and buffer size of each container, arrays in .NET are limited to 2 GB
+        static IEnumerable<(int, long)> Sweep()
+        {
+            foreach (var count in new[] { 1, 10, 100, 1000, 10000, 100000 })
+                foreach (var size in new[] { 64L, 4L << 10, 1L << 20, 64L << 20, 1L << 30, 4L << 30 })
+                    if (count * size <= MaxBytes() && size < int.MaxValue)
+                        yield return (count, size);
+        }
+
+        // Runs f repeatedly for at least half a second, after a warm up run
+        static Result Run(string name, long bytes, Action f)
+        {
+            f();
+            var r = new Result { Name = name, Bytes = bytes };
+            var allocated = GC.GetAllocatedBytesForCurrentThread();
+            var watch = Stopwatch.StartNew();
+            do
+            {
+                f();
+                r.Iterations++;
+            } while (watch.Elapsed.TotalSeconds < 0.5);
+            r.Seconds = watch.Elapsed.TotalSeconds;
+            r.AllocatedBytes = GC.GetAllocatedBytesForCurrentThread() - allocated;
+            Console.WriteLine($"{name,-48} {r.Seconds / r.Iterations * 1e9,14:F0} ns {bytes * r.Iterations / r.Seconds / 1e9,10:F3} GB/s");
+            return r;
+        }
+
+        static string ToJson(IEnumerable<Result> results)
+        {
+            var sb = new StringBuilder();
+            sb.AppendLine("{");
+            sb.AppendLine("  \"context\": { \"library\": \"Vim.BFast\", \"runtime\": \"" + Environment.Version + "\" },");
+            sb.AppendLine("  \"benchmarks\": [");
+            sb.Append(string.Join(",\n", results.Select(r =>
+            {
+                var ns = r.Seconds / r.Iterations * 1e9;
+                return string.Format(CultureInfo.InvariantCulture,
+                    "    {{ \"name\": \"{0}\", \"run_type\": \"iteration\", \"iterations\": {1}, \"real_time\": {2}, \"cpu_time\": {2}, \"time_unit\": \"ns\", \"bytes_per_second\": {3}, \"allocated_bytes_per_op\": {4} }}",
+                    r.Name, r.Iterations, ns, r.Bytes * r.Iterations / r.Seconds, r.AllocatedBytes / r.Iterations);
+            })));
+            sb.AppendLine();
+            sb.AppendLine("  ]");
+            sb.AppendLine("}");
+            return sb.ToString();
+        }
+
+        // The 32-bit FNV-1a hash of a buffer, as written in the manifest
+        static uint Fnv1a32(byte[] bytes)
+        {
+            var h = 2166136261u;
+            foreach (var b in bytes)
+                h = (h ^ b) * 16777619u;
+            return h;
+        }
+
+        // Checks the containers listed in the manifest of a directory written by bfast_roundtrip, and returns the number of failures
+        static int RoundTrip(string dir)
+        {
+            var failures = 0;
+            var bytes = 0L;
+            var readSeconds = 0.0;
+            var writeSeconds = 0.0;
+            var containers = 0;
+            INamedBuffer[] buffers = null;
+            string file = null;
+            foreach (var line in File.ReadAllLines(Path.Combine(dir, "manifest.txt")))
+            {
+                var fields = line.Split('\t');
+                if (fields.Length == 2)
+                {
+                    // A container, followed by its buffers
+                    file = fields[0];
+                    var data = File.ReadAllBytes(Path.Combine(dir, file));
+                    var watch = Stopwatch.StartNew();
+                    try
+                    {
+                        buffers = data.ReadBFast();
+                    }
+                    catch (Exception e)
+                    {
+                        Console.Error.WriteLine($"{file}: {e.Message}");
+                        buffers = null;
+                        failures++;
+                        continue;
+                    }
+                    readSeconds += watch.Elapsed.TotalSeconds;
+                    watch.Restart();
+                    var written = buffers.Select(b => (b.Name, b.ToBytes())).ToArray().WriteBFastToBytes();
+                    writeSeconds += watch.Elapsed.TotalSeconds;
+                    bytes += data.Length;
+                    containers++;
+                    if (buffers.Length != int.Parse(fields[1]))
+                    {
+                        Console.Error.WriteLine($"{file}: expected {fields[1]} buffers, read {buffers.Length}");
+                        failures++;
+                    }
+                    // The C# writer pads the last buffer to the alignment, and the C++ writer ends the stream with it
+                    if (written.Length < data.Length || !new ReadOnlySpan<byte>(written, 0, data.Length).SequenceEqual(data) || written.Skip(data.Length).Any(b => b != 0))
+                    {
+                        Console.Error.WriteLine($"{file}: WriteBFastToBytes wrote different bytes than the C++ writer");
+                        failures++;
+                    }
+                    continue;
+                }
+                if (buffers == null)
+                    continue;
+                var index = int.Parse(fields[1]);
+                var buffer = index < buffers.Length ? buffers[index].ToBytes() : null;
+                var name = string.Join("\t", fields.Skip(4));
+                if (buffer == null || buffer.Length != long.Parse(fields[2]) || Fnv1a32(buffer).ToString("x8") != fields[3] || buffers[index].Name != name)
+                {
+                    Console.Error.WriteLine($"{file}: buffer {index} does not match the manifest");
+                    failures++;
+                }
+            }
+            Console.WriteLine($"{containers} containers, {bytes / readSeconds / 1e9:F3} GB/s read, {bytes / writeSeconds / 1e9:F3} GB/s written, {failures} failures");
+            return failures;
+        }
+
+        public static int Main(string[] args)
+        {
+            var roundTrip = args.Where(a => a.StartsWith("--roundtrip=")).Select(a => a.Substring("--roundtrip=".Length)).FirstOrDefault();
+            if (roundTrip != null)
+                return RoundTrip(roundTrip) > 0 ? 1 : 0;
+
+            var outPath = args.Where(a => a.StartsWith("--benchmark_out=")).Select(a => a.Substring("--benchmark_out=".Length)).FirstOrDefault();
+            var path = "bfast_bench_csharp.tmp.bfast";
+            var results = new List<Result>();
+
+            foreach (var (count, size) in Sweep())
+            {
+                var buffers = Enumerable.Range(0, count).Select(i => ("buffer" + i, Enumerable.Repeat((byte)1, (int)size).ToArray())).ToArray();
+                var packed = buffers.WriteBFastToBytes();
+                var args_ = $"/buffers:{count}/size:{size}";
+
+                results.Add(Run("BM_Pack" + args_, packed.Length, () => buffers.WriteBFastToBytes()));
+                results.Add(Run("BM_Unpack" + args_, packed.Length, () => packed.ReadBFast()));
+                results.Add(Run("BM_WriteFile" + args_ + "/real_time", packed.Length, () =>
+                {
+                    using (var stream = File.Create(path))
+                        stream.WriteBFast(buffers);
+                }));
+                results.Add(Run("BM_ReadFile" + args_ + "/real_time", packed.Length, () =>
+                {
+                    using (var stream = File.OpenRead(path))
+                        stream.ReadBFast().ToArray();
+                }));
+                File.Delete(path);
+            }
+
+            if (outPath != null)
+                File.WriteAllText(outPath, ToJson(results));
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+/*
+    BFAST - Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Reads the containers written by bfast_roundtrip --out=<directory> with js/bfastParser.js, checks the names, sizes and hashes
+    of their buffers against the manifest, and prints the parsing throughput. Run with:
+        node roundtrip.js <directory>
+*/
+
+const fs = require('fs');
+const path = require('path');
+const parseBFast = require('../js/bfastParser.js');
+
+// The 32-bit FNV-1a hash of a buffer, as written in the manifest
+function fnv1a32(bytes)
+{
+    var h = 2166136261;
+    for (var i = 0; i < bytes.length; ++i)
+        h = Math.imul(h ^ bytes[i], 16777619) >>> 0;
+    return h;
+}
+
+function main()
+{
+    if (process.argv.length != 3) {
+        console.error("usage: node roundtrip.js <directory>");
+        process.exit(2);
+    }
+    var dir = process.argv[2];
+    var lines = fs.readFileSync(path.join(dir, 'manifest.txt'), 'utf8').split('\n').filter(line => line.length > 0);
+
+    var failures = 0;
+    var containers = 0;
+    var bytes = 0;
+    var seconds = 0;
+    var parsed = null;
+    var file = null;
+    for (var line of lines) {
+        var fields = line.split('\t');
+        if (fields.length == 2) {
+            // A container, followed by its buffers
+            file = fields[0];
+            var data = fs.readFileSync(path.join(dir, file));
+            var arrayBuffer = data.buffer.slice(data.byteOffset, data.byteOffset + data.byteLength);
+            var start = process.hrtime.bigint();
+            try {
+                parsed = parseBFast(arrayBuffer);
+            }
+            catch (e) {
+                console.error(file + ": " + e.message);
+                parsed = null;
+                failures++;
+                continue;
+            }
+            seconds += Number(process.hrtime.bigint() - start) / 1e9;
+            bytes += data.byteLength;
+            containers++;
+            if (parsed.buffers.length != Number(fields[1])) {
+                console.error(file + ": expected " + fields[1] + " buffers, parsed " + parsed.buffers.length);
+                failures++;
+            }
+            continue;
+        }
+        if (parsed == null)
+            continue;
+        var index = Number(fields[1]);
+        var buffer = parsed.buffers[index];
+        var name = fields.slice(4).join('\t');
+        if (buffer === undefined || buffer.length != Number(fields[2]) || fnv1a32(buffer).toString(16).padStart(8, '0') != fields[3] || parsed.names[index] != name) {
+            console.error(file + ": buffer " + index + " does not match the manifest");
+            failures++;
+        }
+    }
+
+    console.log(containers + " containers, " + (bytes / seconds / 1e9).toFixed(3) + " GB/s parsed, " + failures + " failures");
+    process.exit(failures > 0 ? 1 : 0);
+}
+
+main();
@@ -0,0 +1,139 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    A libFuzzer target for the readers of untrusted byte streams: validate(), BfastRawData::unpack(), BfastData::unpack(),
+    BfastView and BfastLazyReader. Malformed input must be rejected with a runtime_error, and strictly valid input must be accepted
+    by every reader of its byte order: BfastView reads both, the others only native byte order. Input that is accepted must be read
+    the same way by every reader and survive a pack/unpack round trip. Build and run with:
+        clang++ -g -O1 -std=c++17 -fsanitize=fuzzer,address,undefined -I../include bfast_fuzz.cpp -o bfast_fuzz
+        ./bfast_fuzz corpus
+
+    The containers written by bench/bfast_roundtrip.cpp with --out, which include a byte swapped copy of each, make a good seed
+    corpus. Compilers without libFuzzer can build with -DBFAST_FUZZ_MAIN instead, which adds a main() that runs the target on the
+    files given on the command line.
+*/
+
+#include "bfast.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+// Aborts with a message when a property of the readers doesn't hold, so that the fuzzer reports the input
+#define FUZZ_CHECK(condition) \
+    do { if (!(condition)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); abort(); } } while (0)
+
+static bool same(const bfast::ByteRange& a, const bfast::ByteRange& b)
+{
+    return a.size() == b.size() && (a.size() == 0 || memcmp(a.begin(), b.begin(), a.size()) == 0);
+}
+
+// Unpacks the stream, packs the ranges again, and checks that the canonical repacked stream unpacks to the same contents.
+// The unpackers only read native byte order, so they must accept the stream when it is strictly valid and native. 
+static void check_unpack(vector<bfast::byte>& bytes, bool native_valid)
+{
+    bfast::BfastRawData raw;
+    try {
+        raw = bfast::BfastRawData::unpack(bytes);
+    }
+    catch (const runtime_error&) {
+        FUZZ_CHECK(!native_valid);
+        return;
+    }
+    auto packed = raw.pack();
+    FUZZ_CHECK(!native_valid || bfast::validate(packed.data(), packed.size()).ok());
+    auto again = bfast::BfastRawData::unpack(packed);
+    FUZZ_CHECK(again.ranges.size() == raw.ranges.size());
+    for (size_t i = 0; i < raw.ranges.size(); ++i)
+        FUZZ_CHECK(same(again.ranges[i], raw.ranges[i]));
+
+    try {
+        auto data = bfast::BfastData::unpack(bytes);
+        FUZZ_CHECK(data.buffers.size() + 1 == max(raw.ranges.size(), (size_t)1));
+        for (size_t i = 0; i < data.buffers.size(); ++i)
+            FUZZ_CHECK(same(data.buffers[i].data, raw.ranges[i + 1]));
+    }
+    catch (const runtime_error&) {
+        FUZZ_CHECK(!native_valid);
+    }
+}
+
+// Reads every name and buffer with a view, which reads both byte orders and must accept any strictly valid stream,
+// and with a lazy reader, which only reads native byte order, and checks that they agree
+static void check_readers(vector<bfast::byte>& bytes, const bfast::ValidationResult& strict)
+{
+    bfast::BfastView view;
+    try {
+        view = bfast::BfastView(bytes.data(), bytes.size());
+        for (size_t i = 0; i < view.num_buffers(); ++i) {
+            auto name = view.name(i);
+            auto found = view.find(name);
+            FUZZ_CHECK(found <= i && view.name(found) == name);
+            view.buffer(i);
+        }
+    }
+    catch (const runtime_error&) {
+        FUZZ_CHECK(!strict.ok());
+        return;
+    }
+
+    try {
+        auto source = make_shared<bfast::CallbackSource>((bfast::ulong)bytes.size(), [&](bfast::ulong offset, bfast::byte* dst, size_t size) {
+            if (offset > bytes.size() || size > bytes.size() - offset)
+                throw runtime_error("read past the end of the stream");
+            memcpy(dst, bytes.data() + offset, size);
+        });
+        bfast::BfastLazyReader lazy(source);
+        FUZZ_CHECK(!view.swapped());
+        FUZZ_CHECK(lazy.num_buffers() == view.num_buffers());
+        for (size_t i = 0; i < view.num_buffers(); ++i) {
+            FUZZ_CHECK(lazy.name(i) == view.name(i));
+            FUZZ_CHECK(same(view.buffer(i), lazy.get(i)));
+        }
+    }
+    catch (const runtime_error&) {
+        FUZZ_CHECK(!strict.ok() || view.swapped());
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    // A copy, so that the readers see memory with the alignment of a real allocation and can't write to the fuzzer's input
+    vector<bfast::byte> bytes(data, data + size);
+    auto strict = bfast::validate(bytes.data(), bytes.size(), true);
+    auto relaxed = bfast::validate(bytes.data(), bytes.size(), false);
+    FUZZ_CHECK(!strict.ok() || relaxed.ok());
+    bfast::ulong magic = 0;
+    if (size >= sizeof(magic))
+        memcpy(&magic, data, sizeof(magic));
+    check_unpack(bytes, strict.ok() && magic == bfast::MAGIC);
+    check_readers(bytes, strict);
+    return 0;
+}
+
+#ifdef BFAST_FUZZ_MAIN
+// Runs the target on each file given on the command line, such as a corpus or a crash reproducer
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        auto file = fopen(argv[i], "rb");
+        if (file == nullptr) {
+            fprintf(stderr, "could not open %s\n", argv[i]);
+            return 1;
+        }
+        vector<uint8_t> bytes;
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            bytes.insert(bytes.end(), chunk, chunk + n);
+        fclose(file);
+        LLVMFuzzerTestOneInput(bytes.data(), bytes.size());
+    }
+    printf("ran %d inputs\n", argc - 1);
+    return 0;
+}
+#endif
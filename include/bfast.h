@@ -10,9 +10,64 @@
 struct version { int major; int minor; int revision; const char* date; } G3D_VERSION = { 1, 0, 1, "2019.9.24" };
 
 #include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <array>
+#if __has_include(<span>)
+#include <span>
+#endif
 #include <assert.h>
 #include <ostream> 
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifdef BFAST_ENABLE_STATS
+#include <chrono>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 namespace bfast
 {
     using namespace std;
@@ -23,7 +78,7 @@ namespace bfast
 
     // Magic numbers for identifying a BFAST format
     const ulong MAGIC = 0xBFA5;
-    const ulong SWAPPED_MAGIC = 0xA5BF << 48;
+    const ulong SWAPPED_MAGIC = (ulong)0xA5BF << 48;
 
     // The size of the header
     static const int header_size = 32;
@@ -31,17 +86,17 @@ namespace bfast
     // The size of array offsets 
     static const int array_offset_size = 16;
 
-    // This is the size of the header + padding to bring to alignment 
-    static const int array_offsets_start = 64;
+    // The array offsets follow the header directly, at byte 32 as in the specification 
+    static const int array_offsets_start = header_size;
 
     // This is sufficient alignment to fit objects natively into 256-bit (32 byte) registers 
     static const int alignment = 64;
 
     // Returns true if the given value is aligned. 
-    static bool is_aligned(size_t n) { return n % alignment == 0; }
+    static constexpr bool is_aligned(size_t n) { return n % alignment == 0; }
 
     // Returns an aligned version of the given value to bring it to alignment 
-    static size_t aligned_value(size_t n) {
+    static constexpr size_t aligned_value(size_t n) {
         if (is_aligned(n)) return n;
         auto r = n + alignment - (n % alignment);
         assert(is_aligned(r));
@@ -54,7 +109,7 @@ namespace bfast
         ulong _end;
     };
 
-    // A data structure at the top of the file. This is followed by 32 bytes of padding, then an array of n array_offsets (where n is equal to num_arrays)
+    // A data structure at the top of the file. This is followed by an array of n array_offsets (where n is equal to num_arrays)
     struct alignas(8) Header {
         ulong magic;         // Either MAGIC (same-endian) of SWAPPED_MAGIC (different-endian)
         ulong data_start;    // >= desc_end and modulo 64 == 0 and <= file_size
@@ -62,6 +117,9 @@ namespace bfast
         ulong num_arrays;    // number of array_headers
     };
 
+    template<typename T> struct TypedRange;
+    struct BfastView;
+
     // A helper struct for representing a range of bytes 
     struct ByteRange {
         byte* _begin;
@@ -69,54 +127,1011 @@ namespace bfast
         ByteRange(byte* begin, byte* end)
             : _begin(begin), _end(end)
         { }
-        byte* begin() { return _begin; }
-        byte* end() { return _end; }
-        size_t size() { return end() - begin(); }
-        string to_string() { retrun string(begin(), end()); }
+        byte* begin() const { return _begin; }
+        byte* end() const { return _end; }
+        size_t size() const { return end() - begin(); }
+        string to_string() const { return string(begin(), end()); }
+
+        // Returns a typed view of the range, checking that it is aligned to required_alignment and holds a whole number of elements 
+        template<typename T>
+        TypedRange<T> as(size_t required_alignment = alignof(T)) const;
+
+        // Returns a view of a BFAST nested in the range, parsed in place 
+        BfastView as_bfast() const;
+    };
+
+    // A typed view of a range of elements in a buffer. The alignment and the size of the underlying bytes are checked once, on construction, 
+    // after which access is the same as through a raw pointer. 
+    template<typename T>
+    struct TypedRange {
+        T* _begin = nullptr;
+        T* _end = nullptr;
+        TypedRange() = default;
+        TypedRange(T* begin, T* end)
+            : _begin(begin), _end(end)
+        { }
+        explicit TypedRange(const ByteRange& range, size_t required_alignment = alignof(T))
+        {
+            if ((uintptr_t)range.begin() % required_alignment != 0)
+                throw runtime_error("byte range is not aligned for the element type");
+            if (range.size() % sizeof(T) != 0)
+                throw runtime_error("byte range size is not a multiple of the element size");
+            _begin = (T*)range.begin();
+            _end = (T*)range.end();
+        }
+        T* begin() const { return _begin; }
+        T* end() const { return _end; }
+        T* data() const { return _begin; }
+        size_t size() const { return end() - begin(); }
+        bool empty() const { return _begin == _end; }
+        T& operator[](size_t i) const { return _begin[i]; }
+        ByteRange bytes() const { return ByteRange((byte*)_begin, (byte*)_end); }
+#ifdef __cpp_lib_span
+        operator span<T>() const { return span<T>(_begin, _end); }
+#endif
     };
 
+    template<typename T>
+    TypedRange<T> ByteRange::as(size_t required_alignment) const {
+        return TypedRange<T>(*this, required_alignment);
+    }
+
     // A Bfast buffer conceptually is a name and a byte-range
     struct Buffer
     {
         string name;
         ByteRange data;
+    };
+
+    // Reverses the byte order of count elements of W bytes each (2, 4, or 8) from src to dst, which may be the same memory 
+    template<size_t W>
+    inline void byte_swap(const void* src, void* dst, size_t count)
+    {
+        static_assert(W == 2 || W == 4 || W == 8, "byte swapping requires 2, 4, or 8 byte elements");
+        auto in = (const byte*)src;
+        auto out = (byte*)dst;
+        auto n = count * W;
+        size_t i = 0;
+#if defined(__AVX2__) || defined(__SSSE3__)
+        alignas(16) int8_t m[16];
+        for (int j = 0; j < 16; ++j)
+            m[j] = (int8_t)((j / W) * W + (W - 1 - j % W));
+        auto mask = _mm_load_si128((const __m128i*)m);
+#if defined(__AVX2__)
+        auto mask256 = _mm256_broadcastsi128_si256(mask);
+        for (; i + 32 <= n; i += 32) {
+            auto x = _mm256_loadu_si256((const __m256i*)(in + i));
+            _mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(x, mask256));
+        }
+#endif
+        for (; i + 16 <= n; i += 16) {
+            auto x = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(x, mask));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= n; i += 16) {
+            auto x = vld1q_u8(in + i);
+            vst1q_u8(out + i, W == 2 ? vrev16q_u8(x) : W == 4 ? vrev32q_u8(x) : vrev64q_u8(x));
+        }
+#endif
+        for (; i < n; i += W) {
+            byte tmp[W];
+            for (size_t j = 0; j < W; ++j)
+                tmp[j] = in[i + W - 1 - j];
+            memcpy(out + i, tmp, W);
+        }
     }
 
-    // A Bfast conceptually is a collection of buffers: named byte arrays 
-    struct BfastData
+    // Copies bytes using non-temporal stores where available, so that large copies which won't be read back soon bypass the cache  
+    inline void copy_non_temporal(byte* dst, const byte* src, size_t n)
     {
-        vector<Buffer> buffers;
+#if defined(__SSE2__) || defined(_M_X64)
+        auto head = min(n, (size_t)((16 - ((uintptr_t)dst & 15)) & 15));
+        memcpy(dst, src, head);
+        size_t i = head;
+        for (; i + 64 <= n; i += 64) {
+            auto a = _mm_loadu_si128((const __m128i*)(src + i));
+            auto b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+            auto c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+            auto d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+            _mm_stream_si128((__m128i*)(dst + i), a);
+            _mm_stream_si128((__m128i*)(dst + i + 16), b);
+            _mm_stream_si128((__m128i*)(dst + i + 32), c);
+            _mm_stream_si128((__m128i*)(dst + i + 48), d);
+        }
+        _mm_sfence();
+        memcpy(dst + i, src + i, n - i);
+#else
+        memcpy(dst, src, n);
+#endif
+    }
 
-        // Construct a raw BFast data block, using the names string argument to store the names data. 
-        BfastRawData to_raw_data(string& name_data) {
-            // Compute the names buffer 
-            names.clear();
-            for (auto b : buffer)
-                names += b.name + '\0';
-            BfastRawData r; 
-            r.ranges.push_back(ByteRange(name_data.begin(), name_data.end());
-            for (auto b : buffers)
-                r.ranges.push_back(b.data);
+    // The polynomial of the CRC32C (Castagnoli) checksum, in reversed bit order 
+    const uint32_t crc32c_polynomial = 0x82F63B78;
+
+    // Computes the CRC32C of a block of bytes one byte at a time, eight bytes per step, continuing from a previous checksum 
+    inline uint32_t crc32c_software(const byte* p, size_t n, uint32_t crc)
+    {
+        static const auto table = []() {
+            array<array<uint32_t, 256>, 8> t;
+            for (uint32_t i = 0; i < 256; ++i) {
+                auto c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c >> 1) ^ (c & 1 ? crc32c_polynomial : 0);
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+                for (int k = 1; k < 8; ++k)
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            return t;
+        }();
+        auto c = ~crc;
+        for (; n >= 8; p += 8, n -= 8) {
+            auto lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+            auto hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+            c = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24]
+                ^ table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
         }
+        for (; n > 0; ++p, --n)
+            c = (c >> 8) ^ table[0][(c ^ *p) & 0xFF];
+        return ~c;
+    }
 
-        // Returns a vector of bytes containing the byte stream. 
-        vector<byte> pack() {
-            string name_data;
-            return to_raw_data(name_data).pack();
+    // A table that advances a raw CRC32C register over a fixed number of zero bytes, used to combine checksums computed independently 
+    struct Crc32cShift
+    {
+        // Creates the table for appending len zero bytes, which must be a power of two 
+        explicit Crc32cShift(size_t len) {
+            // The operator for one zero bit, squared repeatedly to get the operator for len zero bytes 
+            uint32_t op[32], sq[32];
+            op[0] = crc32c_polynomial;
+            for (int i = 1; i < 32; ++i)
+                op[i] = 1u << (i - 1);
+            for (size_t bits = 1; bits < len * 8; bits *= 2) {
+                for (int i = 0; i < 32; ++i)
+                    sq[i] = times(op, op[i]);
+                memcpy(op, sq, sizeof(op));
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+                for (int k = 0; k < 4; ++k)
+                    table[k][i] = times(op, i << (k * 8));
         }
 
-        BfastData& add(string& name, byte* begin, byte* end)
-        {            
-            buffers.push_back(Buffer{ name, ByteRange { begin, end } });
+        uint32_t operator()(uint32_t crc) const {
+            return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+        }
+
+    private:
+        uint32_t table[4][256];
+
+        static uint32_t times(const uint32_t* mat, uint32_t vec) {
+            uint32_t sum = 0;
+            for (; vec != 0; vec >>= 1, ++mat)
+                if (vec & 1)
+                    sum ^= *mat;
+            return sum;
+        }
+    };
+
+#if defined(__x86_64__) || defined(_M_X64)
+    // Returns true if the processor supports the SSE 4.2 CRC32 instruction 
+    inline bool has_hardware_crc32c()
+    {
+#if defined(_MSC_VER)
+        static const bool r = []() { int info[4]; __cpuid(info, 1); return (info[2] & (1 << 20)) != 0; }();
+#else
+        static const bool r = __builtin_cpu_supports("sse4.2");
+#endif
+        return r;
+    }
+
+    // Computes the CRC32C of a block of bytes with the SSE 4.2 CRC32 instruction, continuing from a previous checksum. 
+    // Large blocks are split into three interleaved streams to hide the latency of the instruction, and their checksums are combined. 
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+#endif
+    inline uint32_t crc32c_hardware(const byte* p, size_t n, uint32_t crc)
+    {
+        const size_t stream_size = 8192;
+        static const Crc32cShift shift(stream_size);
+        auto load = [](const byte* q) { ulong v; memcpy(&v, q, sizeof(v)); return v; };
+        ulong c0 = ~crc;
+        for (; n > 0 && ((uintptr_t)p & 7) != 0; ++p, --n)
+            c0 = _mm_crc32_u8((uint32_t)c0, *p);
+        for (; n >= stream_size * 3; p += stream_size * 3, n -= stream_size * 3) {
+            ulong c1 = 0, c2 = 0;
+            for (size_t i = 0; i < stream_size; i += 8) {
+                c0 = _mm_crc32_u64(c0, load(p + i));
+                c1 = _mm_crc32_u64(c1, load(p + stream_size + i));
+                c2 = _mm_crc32_u64(c2, load(p + stream_size * 2 + i));
+            }
+            c0 = shift((uint32_t)c0) ^ (uint32_t)c1;
+            c0 = shift((uint32_t)c0) ^ (uint32_t)c2;
+        }
+        for (; n >= 8; p += 8, n -= 8)
+            c0 = _mm_crc32_u64(c0, load(p));
+        for (; n > 0; ++p, --n)
+            c0 = _mm_crc32_u8((uint32_t)c0, *p);
+        return ~(uint32_t)c0;
+    }
+#endif
+
+    // Computes the CRC32C (Castagnoli) checksum of a block of bytes, continuing from a previous checksum (0 for a new one).
+    // Uses the SSE 4.2 or ARMv8 CRC32 instructions when they are available, and a table driven implementation otherwise. 
+    inline uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0)
+    {
+        auto p = (const byte*)data;
+#if defined(__x86_64__) || defined(_M_X64)
+        if (has_hardware_crc32c())
+            return crc32c_hardware(p, size, crc);
+#elif defined(__ARM_FEATURE_CRC32)
+        auto c = ~crc;
+        for (; size >= 8; p += 8, size -= 8) {
+            ulong v;
+            memcpy(&v, p, sizeof(v));
+            c = __crc32cd(c, v);
+        }
+        for (; size > 0; ++p, --size)
+            c = __crc32cb(c, *p);
+        return ~c;
+#endif
+        return crc32c_software(p, size, crc);
+    }
+
+    // The name of the optional buffer holding the checksums, which is the last buffer when present. 
+    // It contains one CRC32C per named buffer, as 32-bit integers, including an unused entry for itself. 
+    const char* const checksum_table_name = "bfast:checksums";
+
+    // The name of the optional buffer holding the offsets of the names, which is the last buffer, or the one before the checksum table, when present. 
+    // It contains, as 64-bit integers, the offset of each name in the names buffer, including its own and that of the checksum table, 
+    // followed by the size of the names buffer, so that the name of any buffer can be found without parsing the names. 
+    const char* const name_offsets_table_name = "bfast:name_offsets";
+
+    // The name of the buffer holding the compression table of bfast_compression.h, which is the last buffer, or the one before the checksum table. 
+    // A file can't have both a compression table and a name offsets table. 
+    const char* const compression_table_name = "bfast:compression";
+
+    // Computes the contents of a name offsets table for the given names 
+    inline vector<ulong> compute_name_offsets(const vector<string_view>& names)
+    {
+        vector<ulong> r;
+        r.reserve(names.size() + 1);
+        ulong n = 0;
+        for (const auto& name : names) {
+            r.push_back(n);
+            n += name.size() + 1;
+        }
+        r.push_back(n);
+        return r;
+    }
+
+    // Calls f(i) with the position of each NUL character in [p, p + n), in increasing order, until f returns false, 
+    // comparing 32 or 16 bytes at a time where AVX2 or SSE2 is available. Returns false if f stopped the scan. 
+    template<typename F>
+    inline bool for_each_nul(const char* p, size_t n, F f)
+    {
+        size_t i = 0;
+        auto visit = [&](size_t base, uint32_t mask) {
+            for (; mask != 0; mask &= mask - 1) {
+#if defined(_MSC_VER) && !defined(__clang__)
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+#else
+                auto bit = __builtin_ctz(mask);
+#endif
+                if (!f(base + bit))
+                    return false;
+            }
+            return true;
+        };
+#if defined(__AVX2__)
+        for (; i + 32 <= n; i += 32) {
+            auto v = _mm256_loadu_si256((const __m256i*)(p + i));
+            if (!visit(i, (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()))))
+                return false;
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i + 16 <= n; i += 16) {
+            auto v = _mm_loadu_si128((const __m128i*)(p + i));
+            if (!visit(i, (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))))
+                return false;
+        }
+#endif
+        for (; i < n; ++i) {
+            auto q = (const char*)memchr(p + i, 0, n - i);
+            if (q == nullptr)
+                break;
+            i = q - p;
+            if (!f(i))
+                return false;
+        }
+        return true;
+    }
+
+    // Calls f(i) for each i in [0, n) on up to num_threads threads (0 uses the hardware concurrency), and rethrows the first exception thrown 
+    inline void parallel_for(size_t n, unsigned num_threads, const function<void(size_t)>& f)
+    {
+        if (num_threads == 0)
+            num_threads = max(1u, thread::hardware_concurrency());
+        num_threads = (unsigned)min((size_t)num_threads, n);
+        if (num_threads <= 1) {
+            for (size_t i = 0; i < n; ++i)
+                f(i);
+            return;
+        }
+
+        atomic<size_t> next(0);
+        exception_ptr error;
+        mutex error_lock;
+        auto worker = [&]() {
+            for (auto i = next++; i < n; i = next++) {
+                try {
+                    f(i);
+                }
+                catch (...) {
+                    lock_guard<mutex> lock(error_lock);
+                    if (!error)
+                        error = current_exception();
+                    next = n;
+                }
+            }
+        };
+        vector<thread> threads;
+        for (unsigned i = 1; i < num_threads; ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& t : threads)
+            t.join();
+        if (error)
+            rethrow_exception(error);
+    }
+
+    // Names buffers at least this large are split on multiple threads 
+    const size_t parallel_names_threshold = (size_t)1 << 20;
+
+    // Splits a names buffer into at most count names that alias it, and returns the number of names found. 
+    // The last name doesn't need to be terminated. Large buffers are split on up to num_threads threads (0 uses the hardware concurrency): 
+    // each thread finds the separators of one part of the buffer, and the names are numbered after counting the separators of each part. 
+    inline size_t split_names(const char* data, size_t size, size_t count, string_view* out, unsigned num_threads = 0)
+    {
+        if (num_threads == 0)
+            num_threads = max(1u, thread::hardware_concurrency());
+        size_t found = 0;
+        if (size < parallel_names_threshold || num_threads == 1 || count < num_threads) {
+            size_t begin = 0;
+            for_each_nul(data, size, [&](size_t i) {
+                if (found == count)
+                    return false;
+                out[found++] = string_view(data + begin, i - begin);
+                begin = i + 1;
+                return true;
+            });
+            if (found < count && begin < size)
+                out[found++] = string_view(data + begin, size - begin);
+            return found;
+        }
+
+        // The separators with which each part starts and ends, and how many are in each part 
+        auto part_size = aligned_value((size + num_threads - 1) / num_threads);
+        auto num_parts = (size + part_size - 1) / part_size;
+        vector<size_t> counts(num_parts), last(num_parts, (size_t)-1);
+        parallel_for(num_parts, num_threads, [&](size_t k) {
+            auto base = k * part_size;
+            auto n = min(part_size, size - base);
+            size_t c = 0, l = (size_t)-1;
+            for_each_nul(data + base, n, [&](size_t i) { ++c; l = base + i; return true; });
+            counts[k] = c;
+            last[k] = l;
+        });
+        vector<size_t> first_name(num_parts), name_begin(num_parts);
+        size_t total = 0, begin = 0;
+        for (size_t k = 0; k < num_parts; ++k) {
+            first_name[k] = total;
+            name_begin[k] = begin;
+            total += counts[k];
+            if (last[k] != (size_t)-1)
+                begin = last[k] + 1;
+        }
+        parallel_for(num_parts, num_threads, [&](size_t k) {
+            auto base = k * part_size;
+            auto n = min(part_size, size - base);
+            auto j = first_name[k];
+            auto b = name_begin[k];
+            if (j >= count)
+                return;
+            for_each_nul(data + base, n, [&](size_t i) {
+                out[j++] = string_view(data + b, base + i - b);
+                b = base + i + 1;
+                return j < count;
+            });
+        });
+        found = min(total, count);
+        if (found < count && begin < size)
+            out[found++] = string_view(data + begin, size - begin);
+        return found;
+    }
+
+#ifdef BFAST_ENABLE_STATS
+    // Counters of the work done by the library, enabled by defining BFAST_ENABLE_STATS, and updated with relaxed atomic increments.
+    // Without the definition the instrumentation compiles to nothing. Times are in nanoseconds. 
+    struct Stats
+    {
+        atomic<ulong> bytes_copied{ 0 };        // Bytes written by copy_to and pack 
+        atomic<ulong> packs{ 0 };               // Calls to copy_to, copy_to_parallel and pack 
+        atomic<ulong> pack_time{ 0 }; 
+        atomic<ulong> unpacks{ 0 };             // Calls to BfastRawData::unpack 
+        atomic<ulong> unpack_time{ 0 };
+        atomic<ulong> validations{ 0 };         // Byte streams checked by a view or by validate() 
+        atomic<ulong> validation_time{ 0 };
+        atomic<ulong> buffers_touched{ 0 };     // Arrays accessed through a view 
+        atomic<ulong> name_lookups{ 0 };        // Lookups by name through a view 
+        atomic<ulong> name_misses{ 0 };         // Lookups by name that found no buffer 
+        atomic<ulong> files_mapped{ 0 };
+        atomic<ulong> bytes_mapped{ 0 };
+
+        // Calls f(name, value) for each counter, with names following the Prometheus conventions. 
+        // The page faults of the whole process are reported as well, as a proxy for the faults on mapped files. 
+        void for_each(const function<void(const char*, ulong)>& f) const {
+            f("bfast_bytes_copied_total", bytes_copied);
+            f("bfast_packs_total", packs);
+            f("bfast_pack_nanoseconds_total", pack_time);
+            f("bfast_unpacks_total", unpacks);
+            f("bfast_unpack_nanoseconds_total", unpack_time);
+            f("bfast_validations_total", validations);
+            f("bfast_validation_nanoseconds_total", validation_time);
+            f("bfast_buffers_touched_total", buffers_touched);
+            f("bfast_name_lookups_total", name_lookups);
+            f("bfast_name_misses_total", name_misses);
+            f("bfast_files_mapped_total", files_mapped);
+            f("bfast_bytes_mapped_total", bytes_mapped);
+#ifndef _WIN32
+            rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) == 0) {
+                f("process_minor_page_faults_total", (ulong)usage.ru_minflt);
+                f("process_major_page_faults_total", (ulong)usage.ru_majflt);
+            }
+#endif
+        }
+
+        // Sets every counter back to zero 
+        void reset() {
+            for (auto c : { &bytes_copied, &packs, &pack_time, &unpacks, &unpack_time, &validations, &validation_time, 
+                &buffers_touched, &name_lookups, &name_misses, &files_mapped, &bytes_mapped })
+                c->store(0, memory_order_relaxed);
+        }
+    };
+
+    // The counters of the process 
+    inline Stats& stats()
+    {
+        static Stats r;
+        return r;
+    }
+
+    // Adds the time from its construction to its destruction to a counter 
+    struct StatsTimer
+    {
+        explicit StatsTimer(atomic<ulong>& counter) : counter(counter), start(chrono::steady_clock::now()) { }
+        ~StatsTimer() { counter.fetch_add((ulong)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(), memory_order_relaxed); }
+        atomic<ulong>& counter;
+        chrono::steady_clock::time_point start;
+    };
+
+#define BFAST_STATS_ADD(counter, n) ::bfast::stats().counter.fetch_add((::bfast::ulong)(n), ::std::memory_order_relaxed)
+#define BFAST_STATS_TIME(counter) ::bfast::StatsTimer bfast_stats_timer(::bfast::stats().counter)
+#else
+#define BFAST_STATS_ADD(counter, n) ((void)0)
+#define BFAST_STATS_TIME(counter) ((void)0)
+#endif
+
+    // Options for writing a BFAST using multiple threads 
+    struct ParallelOptions {
+        // The number of threads to use, 0 uses the hardware concurrency 
+        unsigned num_threads = 0;
+        // Buffers larger than this are split into chunks of this many bytes that are copied independently 
+        size_t chunk_size = (size_t)4 << 20;
+        // Buffers at least this large are copied with non-temporal stores, 0 disables them 
+        size_t non_temporal_threshold = 0;
+    };
+
+    // The size of a page of virtual memory 
+    inline size_t page_size()
+    {
+        static const size_t r = []() {
+#ifdef _WIN32
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return (size_t)info.dwPageSize;
+#else
+            return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+        }();
+        return r;
+    }
+
+    // The pages that back an allocation 
+    enum PageSize : int {
+        pages_default,              // Memory from the heap 
+        pages_transparent_huge,     // Regular pages, that the kernel is asked to merge into 2 MB pages where it supports it 
+        pages_huge_2mb,             // Explicit 2 MB huge pages, or the large pages of the system on Windows 
+        pages_huge_1gb,             // Explicit 1 GB huge pages, or the large pages of the system on Windows 
+    };
+
+    // Options for allocating an AlignedBuffer. Large outputs benefit from huge pages, which reduce TLB misses, 
+    // and from being placed on the NUMA node of the threads that consume them. 
+    struct AllocationOptions {
+        PageSize pages = pages_default;
+        // Explicit huge pages are only available when the system has reserved them, otherwise regular pages are used, unless this is set 
+        bool require_huge_pages = false;
+        // The NUMA node the memory is bound to on Linux, or preferred on Windows, or -1 to let the first thread that touches a page decide 
+        int numa_node = -1;
+    };
+
+    // An owned and uninitialized block of memory, aligned to the BFAST alignment, which is allocated from the heap, 
+    // or directly from the operating system when huge pages or a NUMA node are requested 
+    struct AlignedBuffer
+    {
+        AlignedBuffer() = default;
+
+        explicit AlignedBuffer(size_t size)
+            : ptr((byte*)::operator new(max(size, (size_t)1), align_val_t(alignment))), length(size)
+        { }
+
+        AlignedBuffer(size_t size, const AllocationOptions& options)
+            : length(size)
+        {
+            if (options.pages == pages_default && options.numa_node < 0)
+                ptr = (byte*)::operator new(max(size, (size_t)1), align_val_t(alignment));
+            else
+                ptr = map_pages(max(size, (size_t)1), options, mapped_size);
+        }
+
+        ~AlignedBuffer() { reset(); }
+
+        AlignedBuffer(AlignedBuffer&& other) noexcept
+            : ptr(other.ptr), length(other.length), mapped_size(other.mapped_size)
+        {
+            other.ptr = nullptr;
+            other.length = 0;
+            other.mapped_size = 0;
+        }
+
+        AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+            if (this != &other) {
+                reset();
+                swap(ptr, other.ptr);
+                swap(length, other.length);
+                swap(mapped_size, other.mapped_size);
+            }
+            return *this;
         }
 
-        static BfastData unpack(vector<byte> data)
+        AlignedBuffer(const AlignedBuffer&) = delete;
+        AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+        byte* data() const { return ptr; }
+        size_t size() const { return length; }
+        byte* begin() const { return ptr; }
+        byte* end() const { return ptr + length; }
+        ByteRange range() const { return ByteRange(begin(), end()); }
+
+        // Frees the memory 
+        void reset() {
+            if (ptr != nullptr && mapped_size > 0) {
+#ifdef _WIN32
+                VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+                munmap(ptr, mapped_size);
+#endif
+            }
+            else if (ptr != nullptr) {
+                ::operator delete(ptr, align_val_t(alignment));
+            }
+            ptr = nullptr;
+            length = 0;
+            mapped_size = 0;
+        }
+
+    private:
+        byte* ptr = nullptr;
+        size_t length = 0;
+        // The size of the pages mapped from the operating system, or 0 if the memory is from the heap 
+        size_t mapped_size = 0;
+
+        static size_t round_up(size_t n, size_t page) { return (n + page - 1) / page * page; }
+
+        // Allocates whole pages, which the operating system provides zeroed on first touch, so nothing is written here 
+        static byte* map_pages(size_t size, const AllocationOptions& options, size_t& mapped_size) {
+            bool explicit_huge = options.pages == pages_huge_2mb || options.pages == pages_huge_1gb;
+#ifdef _WIN32
+            auto node = options.numa_node >= 0 ? (DWORD)options.numa_node : NUMA_NO_PREFERRED_NODE;
+            void* p = nullptr;
+            auto large = GetLargePageMinimum();
+            if (explicit_huge && large > 0) {
+                mapped_size = round_up(size, large);
+                p = VirtualAllocExNuma(GetCurrentProcess(), nullptr, mapped_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+            }
+            if (p == nullptr) {
+                if (explicit_huge && options.require_huge_pages)
+                    throw runtime_error("could not allocate huge pages");
+                mapped_size = round_up(size, page_size());
+                p = VirtualAllocExNuma(GetCurrentProcess(), nullptr, mapped_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+            }
+            if (p == nullptr)
+                throw bad_alloc();
+#else
+            void* p = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+            if (explicit_huge) {
+                int shift = options.pages == pages_huge_2mb ? 21 : 30;
+                mapped_size = round_up(size, (size_t)1 << shift);
+                p = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+            }
+#endif
+            if (p == MAP_FAILED) {
+                if (explicit_huge && options.require_huge_pages)
+                    throw runtime_error("could not allocate huge pages");
+                // Transparent huge pages are only used for the parts of a mapping that are aligned to their size 
+                const size_t huge = (size_t)2 << 20;
+                bool transparent = options.pages != pages_default && size >= huge;
+                mapped_size = round_up(size, transparent ? huge : page_size());
+                auto reserved = transparent ? mapped_size + huge : mapped_size;
+                p = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED)
+                    throw bad_alloc();
+                if (transparent) {
+                    auto begin = (byte*)p;
+                    auto aligned = (byte*)round_up((size_t)begin, huge);
+                    if (aligned > begin)
+                        munmap(begin, aligned - begin);
+                    if (aligned + mapped_size < begin + reserved)
+                        munmap(aligned + mapped_size, begin + reserved - (aligned + mapped_size));
+                    p = aligned;
+#ifdef MADV_HUGEPAGE
+                    madvise(p, mapped_size, MADV_HUGEPAGE);
+#endif
+                }
+            }
+#ifdef __linux__
+            if (options.numa_node >= 0) {
+                // The same as mbind(p, mapped_size, MPOL_BIND, ...) from libnuma's numaif.h 
+                const int mpol_bind = 2;
+                const size_t bits = 8 * sizeof(unsigned long);
+                unsigned long mask[1024 / bits] = {};
+                auto node = (size_t)options.numa_node;
+                if (node < 1024)
+                    mask[node / bits] |= 1UL << (node % bits);
+                if (node >= 1024 || syscall(SYS_mbind, p, mapped_size, mpol_bind, mask, (unsigned long)1024 + 1, 0) != 0) {
+                    munmap(p, mapped_size);
+                    throw runtime_error("could not bind memory to NUMA node " + std::to_string(options.numa_node));
+                }
+            }
+#endif
+#endif
+            return (byte*)p;
+        }
+    };
+
+    // A 128-bit hash of a block of bytes 
+    struct Hash128 {
+        ulong low;
+        ulong high;
+        bool operator==(const Hash128& other) const { return low == other.low && high == other.high; }
+        bool operator!=(const Hash128& other) const { return !(*this == other); }
+        bool operator<(const Hash128& other) const { return low != other.low ? low < other.low : high < other.high; }
+    };
+
+    // The 128-bit MurmurHash3 (x64 variant) of a block of bytes, read in native byte order 
+    inline Hash128 hash128(const void* data, size_t size, ulong seed = 0)
+    {
+        const ulong c1 = 0x87c37b91114253d5ULL;
+        const ulong c2 = 0x4cf5ad432745937fULL;
+        auto rotl = [](ulong x, int r) { return (x << r) | (x >> (64 - r)); };
+        auto fmix = [](ulong k) {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            k ^= k >> 33;
+            return k;
+        };
+        auto p = (const byte*)data;
+        ulong h1 = seed, h2 = seed;
+        for (size_t i = 0; i + 16 <= size; i += 16) {
+            ulong k1, k2;
+            memcpy(&k1, p + i, 8);
+            memcpy(&k2, p + i + 8, 8);
+            k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+            h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+            k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+            h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+        auto tail = p + (size & ~(size_t)15);
+        auto rest = size & 15;
+        ulong k1 = 0, k2 = 0;
+        for (auto i = rest; i > 8; --i)
+            k2 ^= (ulong)tail[i - 1] << ((i - 9) * 8);
+        if (rest > 8) {
+            k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        }
+        for (auto i = min(rest, (size_t)8); i > 0; --i)
+            k1 ^= (ulong)tail[i - 1] << ((i - 1) * 8);
+        if (rest > 0) {
+            k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        }
+        h1 ^= size;
+        h2 ^= size;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+        h1 += h2;
+        h2 += h1;
+        return { h1, h2 };
+    }
+
+    // Checks that a BFAST header, in native byte order, describes a byte stream of the given size and throws an exception otherwise.
+    inline void check_header(const Header& h, size_t size)
+    {
+        if (h.magic != MAGIC)
+            throw runtime_error("invalid magic number, either not a BFast, or was created on a machine with different endianess");
+        if (h.data_end < h.data_start)
+            throw runtime_error("data ends before it starts");
+        if (h.data_end > size)
+            throw runtime_error("data ends after the end of the byte stream");
+        if (h.num_arrays == 0)
+            return;
+        if (h.data_start < array_offsets_start || h.num_arrays > (h.data_start - array_offsets_start) / array_offset_size)
+            throw runtime_error("array offsets overlap the data section");
+    }
+
+    // Checks that the array offsets, in native byte order, are within the data section described by the header and throws an exception otherwise.
+    inline void check_offsets(const Header& h, const ArrayOffset* offsets)
+    {
+        for (ulong i = 0; i < h.num_arrays; ++i)
         {
-            auto raw_data = BfastRawData.unpack(data);
-            vector<string> names;            
-            string name_data = raw_data.ranges[0].to_string();
+            const auto& offset = offsets[i];
+            if (offset._begin < h.data_start || offset._end < offset._begin || offset._end > h.data_end)
+                throw runtime_error("array offset is outside of the data section");
+            if (!is_aligned(offset._begin))
+                throw runtime_error("array offset is not aligned");
+        }
+    }
+
+    // Checks that the header and the array offsets of a BFAST byte stream can be safely read, and throws an exception otherwise.
+    inline void check_bfast(const byte* data, size_t size)
+    {
+        if (data == nullptr || size < header_size)
+            throw runtime_error("not enough data for a BFast header");
+        const auto& h = *(const Header*)data;
+        check_header(h, size);
+        check_offsets(h, (const ArrayOffset*)(data + array_offsets_start));
+    }
+
+    // Computes where the first array data starts, given the number of arrays 
+    inline constexpr size_t compute_data_start(size_t num_arrays)
+    {
+        size_t r = array_offsets_start;
+        r += array_offset_size * num_arrays;
+        return aligned_value(r);
+    }
+
+    // Computes where each array is relative to the beginning of the BFAST byte stream, given the size of each array in bytes 
+    inline vector<ArrayOffset> compute_offsets(const vector<size_t>& sizes)
+    {
+        size_t n = compute_data_start(sizes.size());
+        vector<ArrayOffset> r;
+        for (auto size : sizes) {
+            assert(is_aligned(n));
+            ArrayOffset offset = { n, n + size };
+            r.push_back(offset);
+            n = aligned_value(n + size);
+        }
+        return r;
+    }
+
+    // The header and the array offsets of a BFAST, which depend on the sizes of the arrays, and for a deduplicated layout 
+    // on which arrays share their data (see share()). A layout can be computed once and reused to write any number of containers 
+    // whose arrays have the same sizes, and for a deduplicated layout the same duplicates. 
+    struct Layout
+    {
+        Header header = {};
+        vector<ArrayOffset> offsets;
+
+        // For each array, the index of the array whose data it shares, which is itself unless the layout was deduplicated by share() 
+        vector<size_t> sources;
+
+        Layout() = default;
+
+        // Computes the layout of arrays of the given sizes, followed by the given number of reserved array offsets 
+        explicit Layout(const vector<size_t>& sizes, size_t reserved_arrays = 0) {
+            init(sizes.size(), reserved_arrays, [&](size_t i) { return sizes[i]; });
+        }
+
+        // The number of bytes of a byte stream with this layout 
+        size_t size() const { return offsets.empty() ? (size_t)header.data_start : (size_t)header.data_end; }
+
+        // Returns true if the arrays of the layout have the given sizes 
+        template<typename SizeFunction>
+        bool matches(size_t num_arrays, SizeFunction size_of) const {
+            if (num_arrays != offsets.size())
+                return false;
+            for (size_t i = 0; i < num_arrays; ++i)
+                if (offsets[i]._end - offsets[i]._begin != size_of(i))
+                    return false;
+            return true;
+        }
+
+        // Places num_arrays arrays whose sizes are given by size_of(i) 
+        template<typename SizeFunction>
+        void init(size_t num_arrays, size_t reserved_arrays, SizeFunction size_of) {
+            auto n = compute_data_start(num_arrays + reserved_arrays);
+            header.magic = MAGIC;
+            header.num_arrays = num_arrays;
+            header.data_start = n;
+            offsets.resize(num_arrays);
+            sources.clear();
+            for (size_t i = 0; i < num_arrays; ++i) {
+                auto size = size_of(i);
+                offsets[i] = { n, n + size };
+                n = aligned_value(n + size);
+            }
+            header.data_end = offsets.empty() ? header.data_start : offsets.back()._end;
+        }
+
+        // Makes each array whose source is an earlier array point at the data of that array, and packs the remaining arrays 
+        void share(const vector<size_t>& sources) {
+            this->sources = sources;
+            auto n = header.data_start;
+            auto end = n;
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                auto size = offsets[i]._end - offsets[i]._begin;
+                if (sources[i] < i) {
+                    offsets[i] = offsets[sources[i]];
+                    continue;
+                }
+                offsets[i] = { n, n + size };
+                end = n + size;
+                n = aligned_value(n + size);
+            }
+            header.data_end = end;
+        }
+
+        // The index of the array whose data is written for the given one 
+        size_t source(size_t i) const { return sources.empty() ? i : sources[i]; }
+
+        // Writes the header, the array offsets, and the padding up to the beginning of the data to out.
+        // A byte stream without arrays has data offsets of zero, like the one written by BfastRawData::copy_to(OutIter_T). 
+        void write_header(byte* out) const {
+            auto h = header;
+            if (offsets.empty())
+                h.data_start = h.data_end = 0;
+            memset(out, 0, (size_t)header.data_start);
+            memcpy(out, &h, sizeof(h));
+            if (!offsets.empty())
+                memcpy(out + array_offsets_start, offsets.data(), offsets.size() * sizeof(ArrayOffset));
+        }
+    };
+
+    // The reasons a byte stream can fail validation 
+    enum ValidationError : int {
+        no_error = 0,
+        error_too_small,                // The byte stream is smaller than the header 
+        error_invalid_magic,            // The magic number is not BFAST in either byte order 
+        error_no_names_buffer,          // There are no arrays, not even the names buffer 
+        error_too_many_arrays,          // The array offsets don't fit before the data section  
+        error_invalid_data_start,       // The data section doesn't start right after the array offsets 
+        error_invalid_data_end,         // The data section ends before it starts, or after the end of the byte stream 
+        error_array_outside_data,       // An array begins before the data section, ends before it begins, or ends after the data section 
+        error_array_not_aligned,        // An array doesn't begin on an aligned offset 
+        error_arrays_overlap,           // An array begins before the end of the previous one 
+        error_missing_names,            // The names buffer contains fewer names than there are named buffers 
+        error_names_not_terminated,     // The last name is not followed by a null character 
+        error_data_start_not_first,     // The first array doesn't begin at the data start 
+        error_data_end_not_last,        // The data section doesn't end where the last array ends 
+        error_extra_names,              // The names buffer contains more names than there are named buffers 
+    };
+
+    // Returns a description of a validation error 
+    inline const char* error_message(ValidationError error)
+    {
+        switch (error) {
+            case no_error: return "no error";
+            case error_too_small: return "not enough data for a BFast header";
+            case error_invalid_magic: return "invalid magic number";
+            case error_no_names_buffer: return "there is no names buffer";
+            case error_too_many_arrays: return "array offsets overlap the data section";
+            case error_invalid_data_start: return "data start is not immediately after the array offsets";
+            case error_invalid_data_end: return "data end is before the data start or after the end of the byte stream";
+            case error_array_outside_data: return "array offset is outside of the data section";
+            case error_array_not_aligned: return "array offset is not aligned";
+            case error_arrays_overlap: return "array overlaps the previous array";
+            case error_missing_names: return "there are fewer names than buffers";
+            case error_names_not_terminated: return "the names buffer is not null terminated";
+            case error_data_start_not_first: return "the first array does not begin at the data start";
+            case error_data_end_not_last: return "the data end is not the end of the last array";
+            case error_extra_names: return "there are more names than buffers";
+        }
+        return "unknown validation error";
+    }
+
+    // The outcome of validating a byte stream: the first error found, and the index of the array it was found in, if any  
+    struct ValidationResult {
+        ValidationError error = no_error;
+        size_t array = npos;
+
+        static const size_t npos = (size_t)-1;
+
+        bool ok() const { return error == no_error; }
+        explicit operator bool() const { return ok(); }
+        const char* message() const { return error_message(error); }
+    };
+
+    // Checks every rule of the specification on a BFAST byte stream from an untrusted source, in either byte order, without throwing or allocating.
+    // The header and the array offsets are read in a single pass, and the only data read is the names buffer, to count names. 
+    // When strict is false, files edited in place are accepted as well: the data may start after reserved array offsets, 
+    // and the arrays may be in any order and overlap.
+    inline ValidationResult validate(const byte* data, size_t size, bool strict = true)
+    {
+        BFAST_STATS_ADD(validations, 1);
+        BFAST_STATS_TIME(validation_time);
+        auto fail = [](ValidationError error, size_t array = ValidationResult::npos) { return ValidationResult{ error, array }; };
+        if (data == nullptr || size < header_size)
+            return fail(error_too_small);
+        Header h;
+        memcpy(&h, data, sizeof(h));
+        auto swapped = h.magic == SWAPPED_MAGIC;
+        if (swapped)
+            byte_swap<sizeof(ulong)>(&h, &h, sizeof(h) / sizeof(ulong));
+        if (h.magic != MAGIC)
+            return fail(error_invalid_magic);
+        if (h.num_arrays == 0)
+            return fail(error_no_names_buffer);
+        if (size < array_offsets_start || h.num_arrays > (size - array_offsets_start) / array_offset_size)
+            return fail(error_too_many_arrays);
+        auto data_start = compute_data_start((size_t)h.num_arrays);
+        if (strict ? h.data_start != data_start : (h.data_start < data_start || !is_aligned((size_t)h.data_start)))
+            return fail(error_invalid_data_start);
+        if (h.data_end < h.data_start || h.data_end > size)
+            return fail(error_invalid_data_end);
 
-        }        
+        auto offsets = data + array_offsets_start;
+        ulong previous_end = h.data_start;
+        ArrayOffset names = {};
+        for (ulong i = 0; i < h.num_arrays; ++i) {
+            ArrayOffset offset;
+            memcpy(&offset, offsets + i * array_offset_size, sizeof(offset));
+            if (swapped)
+                byte_swap<sizeof(ulong)>(&offset, &offset, 2);
+            if (offset._begin < h.data_start || offset._end < offset._begin || offset._end > h.data_end)
+                return fail(error_array_outside_data, (size_t)i);
+            if (!is_aligned((size_t)offset._begin))
+                return fail(error_array_not_aligned, (size_t)i);
+            if (strict && offset._begin < previous_end)
+                return fail(error_arrays_overlap, (size_t)i);
+            if (strict && i == 0 && offset._begin != h.data_start)
+                return fail(error_data_start_not_first, 0);
+            previous_end = offset._end;
+            if (i == 0)
+                names = offset;
+        }
+        if (strict && previous_end != h.data_end)
+            return fail(error_data_end_not_last, (size_t)h.num_arrays - 1);
+
+        auto cur = (const char*)data + names._begin;
+        auto end = (const char*)data + names._end;
+        if (cur != end && end[-1] != '\0')
+            return fail(error_names_not_terminated, 0);
+        for (ulong found = 0; found + 1 < h.num_arrays; ++found) {
+            auto next = cur == end ? nullptr : (const char*)memchr(cur, 0, end - cur);
+            if (next == nullptr)
+                return fail(error_missing_names, 0);
+            cur = next + 1;
+        }
+        if (strict && cur != end)
+            return fail(error_extra_names, 0);
+        return ValidationResult();
     }
 
     // The Bfast container implementation is a container of date ranges: the first one contains the names 
@@ -125,6 +1140,14 @@ namespace bfast
         // Each data buffer 
         vector<ByteRange> ranges;
 
+        // The number of unused array offsets to reserve after the used ones, so that buffers can be added later in place (see BfastEditor) 
+        size_t reserved_arrays = 0;
+
+        // Stores ranges with identical contents once, with all of their array offsets pointing at the same data. 
+        // Readers that use the array offsets are unaffected, but ones that read the arrays sequentially, or validate() when it is strict, 
+        // don't accept overlapping arrays. The ranges are hashed on multiple threads, and equal hashes are confirmed by comparing the bytes. 
+        bool deduplicate = false;
+
         // Computes where the data offsets are relative to the beginning of the BFAST byte stream.
         vector<ArrayOffset> compute_offsets() {
             size_t n = compute_data_start();
@@ -141,26 +1164,94 @@ namespace bfast
 
         // Computes where the first array data starts 
         size_t compute_data_start() {
-            size_t r = 0;
-            r += header_size;
-            r = aligned_value(r);
-            r += array_offset_size * ranges.size();
-            r = aligned_value(r);
-            return r;
+            return bfast::compute_data_start(ranges.size() + reserved_arrays);
         }
 
         // Computes how many bytes are needed to store the current BFAST blob
         size_t compute_needed_size() {
-            auto tmp = compute_offsets();
-            if (tmp.size() == 0)
-                return compute_data_start();
-            return tmp.back()._end;
+            if (deduplicate)
+                return compute_layout().size();
+            auto n = compute_data_start();
+            for (size_t i = 0; i < ranges.size(); ++i)
+                n = i + 1 < ranges.size() ? aligned_value(n + ranges[i].size()) : n + ranges[i].size();
+            return n;
+        }
+
+        // Computes the header and the array offsets, which can be reused for any data whose ranges have the same sizes 
+        Layout compute_layout() const {
+            Layout r;
+            r.init(ranges.size(), reserved_arrays, [&](size_t i) { return ranges[i].size(); });
+            if (deduplicate)
+                r.share(find_duplicates());
+            return r;
+        }
+
+        // Returns, for each range, the index of the first range with the same contents 
+        vector<size_t> find_duplicates() const {
+            auto n = ranges.size();
+            size_t total = 0;
+            for (const auto& r : ranges)
+                total += r.size();
+            vector<Hash128> hashes(n);
+            parallel_for(n, total < ((size_t)1 << 20) ? 1 : 0, [&](size_t i) {
+                hashes[i] = hash128(ranges[i].begin(), ranges[i].size());
+            });
+            vector<size_t> order(n);
+            for (size_t i = 0; i < n; ++i)
+                order[i] = i;
+            sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                if (ranges[a].size() != ranges[b].size())
+                    return ranges[a].size() < ranges[b].size();
+                if (hashes[a] != hashes[b])
+                    return hashes[a] < hashes[b];
+                return a < b;
+            });
+            vector<size_t> r(n);
+            for (size_t i = 0; i < n; ++i)
+                r[i] = i;
+            // Within a group of ranges with the same size and hash, each range is compared with the distinct ones found before it 
+            vector<size_t> distinct;
+            for (size_t g = 0; g < n; ) {
+                auto first = order[g];
+                auto e = g;
+                while (e < n && ranges[order[e]].size() == ranges[first].size() && hashes[order[e]] == hashes[first])
+                    ++e;
+                distinct.clear();
+                for (auto k = g; k < e; ++k) {
+                    auto i = order[k];
+                    if (ranges[i].size() == 0)
+                        break;
+                    for (auto j : distinct) {
+                        if (ranges[i].begin() == ranges[j].begin() || memcmp(ranges[i].begin(), ranges[j].begin(), ranges[i].size()) == 0) {
+                            r[i] = j;
+                            break;
+                        }
+                    }
+                    if (r[i] == i)
+                        distinct.push_back(i);
+                }
+                g = e;
+            }
+            return r;
+        }
+
+        // Returns true if the given layout was computed for ranges of the same sizes as these ones, 
+        // and if it is deduplicated, for ranges whose shared arrays have the same contents as their sources 
+        bool matches(const Layout& layout) const {
+            if (!layout.matches(ranges.size(), [&](size_t i) { return ranges[i].size(); }))
+                return false;
+            for (size_t i = 0; i < layout.sources.size(); ++i) {
+                auto j = layout.source(i);
+                if (j != i && (j > i || memcmp(ranges[i].begin(), ranges[j].begin(), ranges[i].size()) != 0))
+                    return false;
+            }
+            return true;
         }
 
         // Copies the data structure to the bytes stream and update the current index
         template<typename T, typename OutIter_T>
-        OutIter_T copy_to(T& x, OutIter_T out, int& current) {
-            auto begin = (char*)x;
+        OutIter_T copy_to(T& x, OutIter_T out, size_t& current) {
+            auto begin = (char*)&x;
             auto end = begin + sizeof(T);
             current += sizeof(T);
             return copy(begin, end, out);
@@ -168,7 +1259,7 @@ namespace bfast
 
         // Adds zero bytes to the bytes stream for null padding 
         template<typename OutIter_T>
-        OutIter_T output_padding(OutIter_T out, int& current) {
+        OutIter_T output_padding(OutIter_T out, size_t& current) {
             while (!is_aligned(current)) {
                 *out++ = (char)0;
                 current++;
@@ -181,71 +1272,2055 @@ namespace bfast
         void copy_to(OutIter_T out)
         {
             // Initialize and get the data offsets 
-            auto offsets = compute_offsets();
+            auto layout = compute_layout();
+            const auto& offsets = layout.offsets;
             assert(offsets.size() == ranges.size());
             auto n = offsets.size();
-            auto current = 0;
+            size_t current = 0;
 
             // Fill out the header
-            Header h;
-            h.magic = MAGIC;
-            h.num_arrays = n;
-            h.data_start = n == 0 ? 0 : offsets.front()._begin;
-            h.data_end = n == 0 ? 0 : offsets.back()._end;
+            Header h = layout.header;
+            if (n == 0)
+                h.data_start = h.data_end = 0;
 
-            // Copy the header and add padding 
+            // Copy the header 
             out = copy_to(h, out, current);
-            out = output_padding(out, current);
-            assert(is_aligned(current));
+            assert(current == array_offsets_start);
 
-            // Early escape if there are no offsets 
-            if (n == 0)
+            // Early escape with padding, including the reserved array offsets, if there are no offsets 
+            if (n == 0) {
+                while (current < layout.size()) {
+                    *out++ = (char)0;
+                    current++;
+                }
                 return;
+            }
 
-            // Copy the array offsets and add padding 
+            // Copy the array offsets and add padding, including the reserved array offsets 
             for (auto off : offsets)
                 out = copy_to(off, out, current);
-            out = output_padding(out, current);
+            while (current < h.data_start) {
+                *out++ = (char)0;
+                current++;
+            }
             assert(is_aligned(current));
-            assert(current = compute_data_start());
+            assert(current == compute_data_start());
 
-            // Copy the arrays 
-            for (auto i = 0; i < ranges.size(); ++i) {
+            // Copy the arrays, the ones that share the data of an earlier one are already written 
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                if (layout.source(i) != i)
+                    continue;
                 auto range = ranges[i];
                 auto offset = offsets[i];
+                out = output_padding(out, current);
                 assert(current == offset._begin);
                 out = copy(range.begin(), range.end(), out);
                 current += range.size();
                 assert(current == offset._end);
-                output_padding(out, current);
+            }
+        }
+
+        // Copies the BFAST data structure to contiguous memory, which must have room for compute_needed_size() bytes. 
+        // This is a fast path for the generic version above: each block is written with a single memcpy or memset. 
+        void copy_to(byte* out)
+        {
+            copy_to(out, compute_layout());
+        }
+
+        // Copies the BFAST data structure to contiguous memory using a precomputed layout, which must match the ranges (see matches()),
+        // and must have room for layout.size() bytes. Nothing is allocated. 
+        void copy_to(byte* out, const Layout& layout)
+        {
+            if (!matches(layout))
+                throw runtime_error("the layout doesn't match the sizes or the duplicates of the ranges");
+            BFAST_STATS_ADD(packs, 1);
+            BFAST_STATS_ADD(bytes_copied, layout.size());
+            BFAST_STATS_TIME(pack_time);
+            const auto& offsets = layout.offsets;
+            layout.write_header(out);
+            auto written = layout.header.data_start;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                if (layout.source(i) != i)
+                    continue;
+                const auto& range = ranges[i];
+                const auto& offset = offsets[i];
+                memset(out + written, 0, offset._begin - written);
+                if (range.size() > 0)
+                    memcpy(out + offset._begin, range.begin(), range.size());
+                written = offset._end;
             }
         }
 
         vector<byte> pack() {
-            vector<byte> r(compute_needed_size());
-            copy_to(r.data());
+            return pack(compute_layout());
+        }
+
+        // Returns a vector of bytes containing the byte stream, using a precomputed layout 
+        vector<byte> pack(const Layout& layout) {
+            vector<byte> r(layout.size());
+            copy_to(r.data(), layout);
             return r;
         }
 
-        static BfastRawData unpack(vector<byte> data)
-        {
-            const auto& h = *(Header*)&data[0];
-            if (h.magic != MAGIC)
-                throw runtime_error("invalid magic number, either not a BFast, or was created on a machine with different endianess");
-            if (h.data_end < h.data_start)
-                throw runtime_error("data ends before it starts");
+        // Writes the header, the array offsets, and the padding up to the beginning of the data to out
+        static void write_header(byte* out, const vector<ArrayOffset>& offsets) {
+            Header h;
+            h.magic = MAGIC;
+            h.num_arrays = offsets.size();
+            h.data_start = offsets.empty() ? 0 : offsets.front()._begin;
+            h.data_end = offsets.empty() ? 0 : offsets.back()._end;
+            auto data_start = offsets.empty() ? bfast::compute_data_start(0) : offsets.front()._begin;
+            memset(out, 0, data_start);
+            memcpy(out, &h, sizeof(h));
+            if (!offsets.empty())
+                memcpy(out + array_offsets_start, offsets.data(), offsets.size() * sizeof(ArrayOffset));
+        }
 
-            const auto* array_offsets = (ArrayOffset*)& data[array_offsets_start];
-            BfastRawData r;
-            for (auto i = 0; i < h.num_arrays; ++i)
-            {
-                auto offset = array_offsets[i];
-                auto begin = &data[offset._begin];
-                auto end = &data[offset._end];
-                r.ranges.push_back(ByteRange(begin, end));
+        // Copies the BFAST data structure to out, which must have room for compute_needed_size() bytes. 
+        // The buffers are copied on multiple threads, and large buffers are split into chunks. 
+        void copy_to_parallel(byte* out, const ParallelOptions& options = ParallelOptions()) {
+            copy_to_parallel(out, compute_layout(), options);
+        }
+
+        // Copies the BFAST data structure to out on multiple threads, using a precomputed layout which must match the ranges (see matches()) 
+        void copy_to_parallel(byte* out, const Layout& layout, const ParallelOptions& options = ParallelOptions()) {
+            if (!matches(layout))
+                throw runtime_error("the layout doesn't match the sizes or the duplicates of the ranges");
+            BFAST_STATS_ADD(packs, 1);
+            BFAST_STATS_ADD(bytes_copied, layout.size());
+            BFAST_STATS_TIME(pack_time);
+            const auto& offsets = layout.offsets;
+            layout.write_header(out);
+
+            // Each task copies one chunk of one range, the last chunk of a range also zeroes the padding up to the next range that is written
+            struct Task { size_t range; size_t begin; size_t end; };
+            vector<Task> tasks;
+            vector<ulong> padding_end(ranges.size());
+            auto next_begin = layout.size();
+            for (size_t i = ranges.size(); i-- > 0; ) {
+                if (layout.source(i) != i)
+                    continue;
+                padding_end[i] = max(next_begin, offsets[i]._end);
+                next_begin = offsets[i]._begin;
+            }
+            auto chunk_size = max(options.chunk_size, (size_t)alignment);
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                if (layout.source(i) != i)
+                    continue;
+                auto size = ranges[i].size();
+                size_t begin = 0;
+                do {
+                    auto end = min(size, begin + chunk_size);
+                    tasks.push_back({ i, begin, end });
+                    begin = end;
+                } while (begin < size);
             }
 
+            parallel_for(tasks.size(), options.num_threads, [&](size_t i) {
+                const auto& task = tasks[i];
+                const auto& range = ranges[task.range];
+                const auto& offset = offsets[task.range];
+                auto dst = out + offset._begin + task.begin;
+                auto src = range.begin() + task.begin;
+                auto n = task.end - task.begin;
+                if (options.non_temporal_threshold > 0 && range.size() >= options.non_temporal_threshold)
+                    copy_non_temporal(dst, src, n);
+                else if (n > 0)
+                    memcpy(dst, src, n);
+                if (task.end == range.size())
+                    memset(out + offset._end, 0, padding_end[task.range] - offset._end);
+            });
+        }
+
+        // Returns a vector of bytes containing the byte stream, copying the buffers on multiple threads 
+        vector<byte> pack_parallel(const ParallelOptions& options = ParallelOptions()) {
+            vector<byte> r(compute_needed_size());
+            copy_to_parallel(r.data(), options);
+            return r;
+        }
+
+        // Returns the byte stream in memory allocated with the given options. Unlike pack(), the memory is not zero-filled first: 
+        // apart from the arrays, only the header and the padding are written. 
+        AlignedBuffer pack_aligned(const AllocationOptions& allocation = AllocationOptions()) {
+            return pack_aligned(compute_layout(), allocation);
+        }
+
+        // Returns the byte stream in memory allocated with the given options, using a precomputed layout 
+        AlignedBuffer pack_aligned(const Layout& layout, const AllocationOptions& allocation = AllocationOptions()) {
+            AlignedBuffer r(layout.size(), allocation);
+            copy_to(r.data(), layout);
             return r;
         }
+
+        // Returns the byte stream in memory allocated with the given options, copying the buffers on multiple threads, 
+        // so that the pages of memory that isn't bound to a NUMA node are spread over the nodes of the threads 
+        AlignedBuffer pack_parallel_aligned(const AllocationOptions& allocation, const ParallelOptions& options = ParallelOptions()) {
+            auto layout = compute_layout();
+            AlignedBuffer r(layout.size(), allocation);
+            copy_to_parallel(r.data(), layout, options);
+            return r;
+        }
+
+        // Creates ranges that point into the given byte vector, which must outlive the result 
+        static BfastRawData unpack(vector<byte>& data)
+        {
+            return unpack(data.data(), data.size());
+        }
+
+        // Creates ranges that point into the given BFAST byte stream, without copying any data 
+        static BfastRawData unpack(byte* data, size_t size)
+        {
+            BFAST_STATS_ADD(unpacks, 1);
+            BFAST_STATS_TIME(unpack_time);
+            check_bfast(data, size);
+            const auto& h = *(const Header*)data;
+            const auto* array_offsets = (const ArrayOffset*)(data + array_offsets_start);
+            BfastRawData r;
+            for (ulong i = 0; i < h.num_arrays; ++i)
+            {
+                auto offset = array_offsets[i];
+                auto begin = data + offset._begin;
+                auto end = data + offset._end;
+                r.ranges.push_back(ByteRange(begin, end));
+            }
+
+            return r;
+        }
+    };
+
+    // A Bfast conceptually is a collection of buffers: named byte arrays 
+    struct BfastData
+    {
+        vector<Buffer> buffers;
+
+        // The number of unused array offsets to reserve, so that buffers can be added later in place (see BfastEditor) 
+        size_t reserved_arrays = 0;
+
+        // Stores buffers with identical contents once (see BfastRawData::deduplicate) 
+        bool deduplicate = false;
+
+        // Adds a table of the offsets of the names, so that readers can find the name of any buffer without parsing the names buffer 
+        bool with_name_offsets = false;
+
+        // Construct a raw BFast data block, using the names string argument to store the names data. 
+        // The name offsets table is stored in name_data as well, after the names. 
+        BfastRawData to_raw_data(string& name_data) {
+            // The name offsets table goes before the checksum table, which has to be the last buffer 
+            auto n = buffers.size();
+            auto table_at = with_name_offsets && n > 0 && buffers.back().name == checksum_table_name ? n - 1 : n;
+            vector<string_view> names;
+            for (size_t i = 0; i <= n; ++i) {
+                if (with_name_offsets && i == table_at)
+                    names.push_back(name_offsets_table_name);
+                if (i < n)
+                    names.push_back(buffers[i].name);
+            }
+
+            // Compute the names buffer 
+            name_data.clear();
+            for (const auto& name : names) {
+                name_data += name;
+                name_data += '\0';
+            }
+            auto names_size = name_data.size();
+            if (with_name_offsets) {
+                auto table = compute_name_offsets(names);
+                name_data.append((const char*)table.data(), table.size() * sizeof(ulong));
+            }
+            BfastRawData r; 
+            r.reserved_arrays = reserved_arrays;
+            r.deduplicate = deduplicate;
+            auto names_begin = (byte*)name_data.data();
+            r.ranges.reserve(names.size() + 1);
+            r.ranges.push_back(ByteRange(names_begin, names_begin + names_size));
+            for (size_t i = 0; i <= n; ++i) {
+                if (with_name_offsets && i == table_at)
+                    r.ranges.push_back(ByteRange(names_begin + names_size, names_begin + name_data.size()));
+                if (i < n)
+                    r.ranges.push_back(buffers[i].data);
+            }
+            return r;
+        }
+
+        // Returns a vector of bytes containing the byte stream. 
+        vector<byte> pack() {
+            string name_data;
+            return to_raw_data(name_data).pack();
+        }
+
+        // Returns a vector of bytes containing the byte stream, copying the buffers on multiple threads 
+        vector<byte> pack_parallel(const ParallelOptions& options = ParallelOptions()) {
+            string name_data;
+            return to_raw_data(name_data).pack_parallel(options);
+        }
+
+        // Returns the byte stream in memory allocated with the given options, without zero-filling it first 
+        AlignedBuffer pack_aligned(const AllocationOptions& allocation = AllocationOptions()) {
+            string name_data;
+            return to_raw_data(name_data).pack_aligned(allocation);
+        }
+
+        // Returns the byte stream in memory allocated with the given options, copying the buffers on multiple threads 
+        AlignedBuffer pack_parallel_aligned(const AllocationOptions& allocation, const ParallelOptions& options = ParallelOptions()) {
+            string name_data;
+            return to_raw_data(name_data).pack_parallel_aligned(allocation, options);
+        }
+
+        // Returns a vector of bytes containing the byte stream followed by a checksum table, computing the checksums on multiple threads 
+        vector<byte> pack_with_checksums(const ParallelOptions& options = ParallelOptions()) {
+            // The name offsets table is added as a regular buffer, so that it has a checksum too 
+            auto r = *this;
+            vector<ulong> table;
+            if (with_name_offsets) {
+                vector<string_view> names;
+                for (const auto& b : buffers)
+                    names.push_back(b.name);
+                names.push_back(name_offsets_table_name);
+                names.push_back(checksum_table_name);
+                table = compute_name_offsets(names);
+                r.with_name_offsets = false;
+                r.add(name_offsets_table_name, (byte*)table.data(), (byte*)(table.data() + table.size()));
+            }
+            vector<uint32_t> checksums(r.buffers.size() + 1);
+            parallel_for(r.buffers.size(), options.num_threads, [&](size_t i) {
+                checksums[i] = crc32c(r.buffers[i].data.begin(), r.buffers[i].data.size());
+            });
+            r.add(checksum_table_name, (byte*)checksums.data(), (byte*)(checksums.data() + checksums.size()));
+            return r.pack_parallel(options);
+        }
+
+        BfastData& add(const string& name, byte* begin, byte* end)
+        {            
+            buffers.push_back(Buffer{ name, ByteRange { begin, end } });
+            return *this;
+        }
+
+        // Creates buffers that point into the given byte vector, which must outlive the result 
+        static BfastData unpack(vector<byte>& data)
+        {
+            auto raw_data = BfastRawData::unpack(data);
+            if (raw_data.ranges.empty())
+                return BfastData();
+            auto n = raw_data.ranges.size() - 1;
+            const auto& names_range = raw_data.ranges[0];
+            vector<string_view> names(n);
+            if (split_names((const char*)names_range.begin(), names_range.size(), n, names.data()) < n)
+                throw runtime_error("there are fewer names than buffers");
+            BfastData r;
+            r.buffers.reserve(n);
+            for (size_t i = 0; i < n; ++i)
+                r.buffers.push_back(Buffer{ string(names[i]), raw_data.ranges[i + 1] });
+            return r;
+        }
+    };
+
+    // Builds a BFAST in a single allocation that is laid out exactly as the final byte stream. 
+    // The buffers are declared up front with their name and size. The first request for a buffer allocates the storage and writes the header, 
+    // array offsets, names, and padding, after which producers write each buffer directly into its final position, and pack() copies nothing. 
+    // A buffer can itself be a nested BFAST, declared with add_child(), whose layout is computed along with the rest of the tree. 
+    struct BfastBuilder
+    {
+        BfastBuilder() = default;
+
+        // Creates a builder whose storage is allocated with the given options, for example on huge pages 
+        explicit BfastBuilder(const AllocationOptions& allocation) : allocation(allocation) { }
+
+        BfastBuilder(BfastBuilder&& other) noexcept { *this = std::move(other); }
+
+        BfastBuilder& operator=(BfastBuilder&& other) noexcept {
+            names = std::move(other.names);
+            sizes = std::move(other.sizes);
+            children = std::move(other.children);
+            offsets = std::move(other.offsets);
+            storage = std::move(other.storage);
+            allocation = other.allocation;
+            base = other.base;
+            parent = other.parent;
+            other.base = nullptr;
+            other.parent = nullptr;
+            for (auto& child : children)
+                if (child)
+                    child->parent = this;
+            return *this;
+        }
+
+        BfastBuilder(const BfastBuilder&) = delete;
+        BfastBuilder& operator=(const BfastBuilder&) = delete;
+
+        // Declares a buffer with the given name and size in bytes, and returns its index 
+        size_t add(const string& name, size_t size) {
+            if (allocated())
+                throw runtime_error("buffers can't be added after the storage is allocated");
+            names += name;
+            names += '\0';
+            sizes.push_back(size);
+            children.emplace_back();
+            return sizes.size() - 1;
+        }
+
+        // Declares a buffer with the given name that is a nested BFAST, and returns the builder for it, which is owned by this builder 
+        BfastBuilder& add_child(const string& name) {
+            auto i = add(name, 0);
+            children[i].reset(new BfastBuilder());
+            children[i]->parent = this;
+            return *children[i];
+        }
+
+        // The number of declared buffers 
+        size_t num_buffers() const { return sizes.size(); }
+
+        // Returns the nested builder of the buffer at the given index 
+        BfastBuilder& child(size_t i) {
+            if (i >= num_buffers() || !children[i])
+                throw runtime_error("buffer is not a nested BFAST");
+            return *children[i];
+        }
+
+        // Computes how many bytes are needed to store the BFAST byte stream 
+        size_t compute_needed_size() { return compute_layout(); }
+
+        // Allocates the storage for the whole tree and writes everything except the buffer data 
+        void allocate() {
+            if (parent != nullptr) {
+                parent->allocate();
+                return;
+            }
+            if (allocated())
+                return;
+            storage = AlignedBuffer(compute_layout(), allocation);
+            place(storage.data());
+        }
+
+        // Returns the storage of the buffer at the given index, to be filled in by the producer 
+        ByteRange buffer(size_t i) {
+            if (i >= num_buffers())
+                throw out_of_range("buffer index out of range");
+            allocate();
+            const auto& offset = offsets[i + 1];
+            return ByteRange(base + offset._begin, base + offset._end);
+        }
+
+        // Returns the storage of the buffer at the given index as an array of T
+        template<typename T>
+        TypedRange<T> buffer_as(size_t i) { return buffer(i).as<T>(); }
+
+        // Returns the BFAST byte stream, the builder is empty afterwards 
+        AlignedBuffer pack() {
+            if (parent != nullptr)
+                throw runtime_error("only the outermost builder can be packed");
+            allocate();
+            auto r = std::move(storage);
+            *this = BfastBuilder(allocation);
+            return r;
+        }
+
+    private:
+        string names;
+        vector<size_t> sizes;
+        vector<unique_ptr<BfastBuilder>> children;
+        vector<ArrayOffset> offsets;
+        AlignedBuffer storage;
+        AllocationOptions allocation;
+        byte* base = nullptr;
+        BfastBuilder* parent = nullptr;
+
+        bool allocated() const { return base != nullptr; }
+
+        // Computes the offsets of this builder and all nested builders in one pass, and returns the size of the byte stream 
+        size_t compute_layout() {
+            if (allocated())
+                return offsets.back()._end;
+            vector<size_t> array_sizes = { names.size() };
+            for (size_t i = 0; i < sizes.size(); ++i)
+                array_sizes.push_back(children[i] ? children[i]->compute_layout() : sizes[i]);
+            offsets = compute_offsets(array_sizes);
+            return offsets.back()._end;
+        }
+
+        // Writes the header, names and padding of this builder and all nested builders, using the computed layout 
+        void place(byte* p) {
+            base = p;
+            BfastRawData::write_header(base, offsets);
+            memcpy(base + offsets[0]._begin, names.data(), names.size());
+            for (size_t i = 0; i + 1 < offsets.size(); ++i)
+                memset(base + offsets[i]._end, 0, offsets[i + 1]._begin - offsets[i]._end);
+            for (size_t i = 0; i < children.size(); ++i)
+                if (children[i])
+                    children[i]->place(base + offsets[i + 1]._begin);
+        }
+    };
+
+    // A read-only hash index from names to buffer indices, over string views into a names buffer. 
+    // Uses open addressing with linear probing. Duplicate names are all kept, and are found in buffer order.
+    struct NameIndex
+    {
+        static const size_t npos = (size_t)-1;
+
+        NameIndex() = default;
+
+        // Builds the index over a names buffer that contains at least count NUL separated names, any additional names are ignored. 
+        // Large buffers are split and hashed on up to num_threads threads (0 uses the hardware concurrency). 
+        NameIndex(const char* data, size_t size, size_t count, unsigned num_threads = 0)
+        {
+            names.resize(count);
+            if (split_names(data, size, count, names.data(), num_threads) < count)
+                throw runtime_error("there are fewer names than buffers");
+
+            size_t capacity = 16;
+            while (capacity < count * 2)
+                capacity *= 2;
+            slots.resize(capacity);
+            mask = capacity - 1;
+            vector<size_t> hashes(count);
+            parallel_for(count, size < parallel_names_threshold ? 1 : num_threads, [&](size_t i) { hashes[i] = hash(names[i]); });
+            for (size_t i = 0; i < count; ++i) {
+                auto h = hashes[i];
+                auto j = h & mask;
+                while (slots[j].index != 0)
+                    j = (j + 1) & mask;
+                slots[j] = { (uint32_t)h, (uint32_t)(i + 1) };
+            }
+        }
+
+        // Returns the index of the first buffer with the given name, or npos if there is none 
+        size_t find(string_view name) const {
+            auto h = hash(name);
+            for (auto j = h & mask; !slots.empty() && slots[j].index != 0; j = (j + 1) & mask)
+                if (slots[j].hash == (uint32_t)h && names[slots[j].index - 1] == name)
+                    return slots[j].index - 1;
+            return npos;
+        }
+
+        // Returns the indices of all buffers with the given name, in buffer order 
+        vector<size_t> find_all(string_view name) const {
+            vector<size_t> r;
+            auto h = hash(name);
+            for (auto j = h & mask; !slots.empty() && slots[j].index != 0; j = (j + 1) & mask)
+                if (slots[j].hash == (uint32_t)h && names[slots[j].index - 1] == name)
+                    r.push_back(slots[j].index - 1);
+            return r;
+        }
+
+        // The name of the buffer at the given index 
+        string_view name(size_t i) const { return names.at(i); }
+
+        // The number of indexed names 
+        size_t size() const { return names.size(); }
+
+        // FNV-1a hash of a name 
+        static size_t hash(string_view name) {
+            uint64_t h = 14695981039346656037ull;
+            for (auto c : name)
+                h = (h ^ (uint8_t)c) * 1099511628211ull;
+            return (size_t)(h ^ (h >> 32));
+        }
+
+    private:
+        struct Slot { uint32_t hash; uint32_t index; };
+        vector<string_view> names;
+        vector<Slot> slots;
+        size_t mask = 0;
+    };
+
+    // How a range of memory is going to be accessed, given as a hint to the virtual memory system 
+    enum AccessPattern : int {
+        access_normal,          // No particular order 
+        access_sequential,      // In increasing order, so pages can be read ahead aggressively and dropped after use 
+        access_random,          // In no predictable order, so reading ahead is wasted 
+        access_will_need,       // Soon, so the pages can be read in the background now 
+    };
+
+    // Passes an access pattern hint for the pages spanned by the given range to the operating system, with madvise or PrefetchVirtualMemory.
+    // Returns false if the hint is not supported or was rejected, which is harmless, since hints don't change the contents of memory. 
+    inline bool advise(const void* begin, size_t size, AccessPattern pattern)
+    {
+        if (size == 0)
+            return true;
+        auto first = (uintptr_t)begin & ~(uintptr_t)(page_size() - 1);
+        auto last = ((uintptr_t)begin + size + page_size() - 1) & ~(uintptr_t)(page_size() - 1);
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+        if (pattern != access_will_need && pattern != access_sequential)
+            return false;
+        WIN32_MEMORY_RANGE_ENTRY entry = { (void*)first, (size_t)(last - first) };
+        return PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0) != 0;
+#else
+        (void)first; (void)last; (void)pattern;
+        return false;
+#endif
+#else
+        int advice = pattern == access_sequential ? MADV_SEQUENTIAL
+            : pattern == access_random ? MADV_RANDOM
+            : pattern == access_will_need ? MADV_WILLNEED
+            : MADV_NORMAL;
+        return madvise((void*)first, (size_t)(last - first), advice) == 0;
+#endif
+    }
+
+    // Reads one byte of every page spanned by the given range, so that they are mapped before they are used 
+    inline void prefault(const void* begin, size_t size)
+    {
+        if (size == 0)
+            return;
+        auto p = (const volatile byte*)begin;
+        byte sum = 0;
+        for (size_t i = 0; i < size; i += page_size() - ((uintptr_t)(p + i) & (page_size() - 1)))
+            sum ^= p[i];
+        sum ^= p[size - 1];
+        (void)sum;
+    }
+
+    // A memory mapping of an entire file. Pages are mapped copy-on-write, so writes through the mapped memory never reach the file.
+    struct MappedFile
+    {
+        byte* data = nullptr;
+        size_t size = 0;
+
+        explicit MappedFile(const string& path)
+        {
+#ifdef _WIN32
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                throw runtime_error("could not open file " + path);
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size)) {
+                CloseHandle(file);
+                throw runtime_error("could not get size of file " + path);
+            }
+            size = (size_t)file_size.QuadPart;
+            if (size > 0) {
+                mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+                CloseHandle(file);
+                if (mapping == nullptr)
+                    throw runtime_error("could not map file " + path);
+                data = (byte*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+                if (data == nullptr) {
+                    CloseHandle(mapping);
+                    throw runtime_error("could not map file " + path);
+                }
+            }
+            else {
+                CloseHandle(file);
+            }
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw runtime_error("could not open file " + path);
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw runtime_error("could not get size of file " + path);
+            }
+            size = (size_t)st.st_size;
+            if (size > 0) {
+                auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+                if (p == MAP_FAILED)
+                    throw runtime_error("could not map file " + path);
+                data = (byte*)p;
+            }
+            else {
+                ::close(fd);
+            }
+#endif
+            BFAST_STATS_ADD(files_mapped, 1);
+            BFAST_STATS_ADD(bytes_mapped, size);
+        }
+
+#ifndef _WIN32
+        // Maps the first size bytes of an open file descriptor, such as a shared memory object, which can be closed afterwards. 
+        // Like a mapped file, the mapping is private: writes, such as byte order conversions, are not seen by other processes. 
+        MappedFile(int fd, size_t size)
+            : size(size)
+        {
+            if (size == 0)
+                return;
+            auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+                throw runtime_error("could not map file descriptor");
+            data = (byte*)p;
+            BFAST_STATS_ADD(files_mapped, 1);
+            BFAST_STATS_ADD(bytes_mapped, size);
+        }
+#endif
+
+        ~MappedFile()
+        {
+            if (data == nullptr)
+                return;
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+            CloseHandle(mapping);
+#else
+            munmap(data, size);
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+#ifdef _WIN32
+    private:
+        HANDLE mapping = nullptr;
+#endif
+    };
+
+    // A zero-copy view of a BFAST byte stream. The header and array offsets are validated and read in place, and all ranges alias the underlying memory. 
+    struct BfastView
+    {
+        byte* data = nullptr;
+        size_t size = 0;
+
+        // Keeps the memory alive when the view was created from a mapped file 
+        shared_ptr<MappedFile> mapping;
+
+        static const size_t npos = NameIndex::npos;
+
+        BfastView() = default;
+
+        // Creates a view of a BFAST byte stream. A stream written with a different endianness is accepted: 
+        // its header and array offsets are converted to native byte order, and its buffers are converted on demand.  
+        BfastView(byte* data, size_t size, shared_ptr<MappedFile> mapping = nullptr)
+            : data(data), size(size), mapping(std::move(mapping))
+        {
+            BFAST_STATS_ADD(validations, 1);
+            BFAST_STATS_TIME(validation_time);
+            if (data == nullptr || size < header_size)
+                throw runtime_error("not enough data for a BFast header");
+            memcpy(&native_header, data, sizeof(Header));
+            is_swapped = native_header.magic == SWAPPED_MAGIC;
+            if (is_swapped) {
+                byte_swap<sizeof(ulong)>(&native_header, &native_header, sizeof(Header) / sizeof(ulong));
+                check_header(native_header, size);
+                lazy->native_offsets.resize(native_header.num_arrays);
+                byte_swap<sizeof(ulong)>(data + array_offsets_start, lazy->native_offsets.data(), native_header.num_arrays * 2);
+                lazy->swapped_in_place.resize(native_header.num_arrays);
+                native_offsets = lazy->native_offsets.data();
+            }
+            else {
+                check_header(native_header, size);
+                native_offsets = (const ArrayOffset*)(data + array_offsets_start);
+            }
+            check_offsets(native_header, native_offsets);
+        }
+
+        // Creates a view of a byte stream that validate() has already accepted, without checking its header and array offsets again. 
+        // A stream written with a different endianness is converted as by the constructor. 
+        static BfastView from_validated(byte* data, size_t size, shared_ptr<MappedFile> mapping = nullptr) {
+            Header h;
+            memcpy(&h, data, sizeof(Header));
+            if (h.magic != MAGIC)
+                return BfastView(data, size, std::move(mapping));
+            BfastView r;
+            r.data = data;
+            r.size = size;
+            r.mapping = std::move(mapping);
+            r.native_header = h;
+            r.native_offsets = (const ArrayOffset*)(data + array_offsets_start);
+            return r;
+        }
+
+        // The header, in native byte order 
+        const Header& header() const { return native_header; }
+
+        // The array offsets, in native byte order 
+        const ArrayOffset* offsets() const { return native_offsets; }
+
+        // Returns true if the byte stream was written on a machine with a different endianness 
+        bool swapped() const { return is_swapped; }
+
+        // The number of arrays, including the names buffer 
+        size_t num_arrays() const { return data == nullptr ? 0 : (size_t)header().num_arrays; }
+
+        // The number of named buffers, not counting the names buffer 
+        size_t num_buffers() const { return num_arrays() == 0 ? 0 : num_arrays() - 1; }
+
+        // Returns the range of the array at the given index, the names buffer is at index 0 
+        ByteRange range(size_t i) const {
+            if (i >= num_arrays())
+                throw out_of_range("array index out of range");
+            BFAST_STATS_ADD(buffers_touched, 1);
+            const auto& offset = offsets()[i];
+            return ByteRange(data + offset._begin, data + offset._end);
+        }
+
+        // Returns the names buffer 
+        ByteRange names() const { return range(0); }
+
+        // Returns the range of the named buffer at the given index 
+        ByteRange buffer(size_t i) const { return range(i + 1); }
+
+        // Returns the ranges of all arrays, aliasing the underlying memory
+        BfastRawData to_raw_data() const {
+            BfastRawData r;
+            for (size_t i = 0; i < num_arrays(); ++i)
+                r.ranges.push_back(range(i));
+            return r;
+        }
+
+        // Returns the hash index of the buffer names, which is built on first use 
+        const NameIndex& name_index() const {
+            call_once(lazy->names_built, [this]() {
+                auto r = num_arrays() == 0 ? ByteRange(nullptr, nullptr) : names();
+                lazy->name_index = NameIndex((const char*)r.begin(), r.size(), num_buffers());
+            });
+            return lazy->name_index;
+        }
+
+        // Returns the name of the buffer at the given index, from the name offsets table if there is one, without building the name index 
+        string_view name(size_t i) const {
+            auto table = name_offsets();
+            if (table == nullptr)
+                return name_index().name(i);
+            if (i >= num_buffers())
+                throw out_of_range("buffer index out of range");
+            auto r = names();
+            return string_view((const char*)r.begin() + table[i], (size_t)(table[i + 1] - table[i] - 1));
+        }
+
+        // Returns true if the byte stream has a name offsets table 
+        bool has_name_offsets() const { return name_offsets() != nullptr; }
+
+        // Returns the index of the first buffer with the given name, or npos if there is none 
+        size_t find(string_view name) const { 
+            auto r = name_index().find(name);
+            BFAST_STATS_ADD(name_lookups, 1);
+            BFAST_STATS_ADD(name_misses, r == npos);
+            return r;
+        }
+
+        // Returns the indices of all buffers with the given name 
+        vector<size_t> find_all(string_view name) const { return name_index().find_all(name); }
+
+        // Returns a view of the BFAST nested in the buffer at the given index, parsed in place and sharing this view's memory 
+        BfastView child(size_t i) const {
+            auto r = buffer(i);
+            return BfastView(r.begin(), r.size(), mapping);
+        }
+
+        // Returns a view of the BFAST nested in the first buffer with the given name 
+        BfastView child(string_view name) const {
+            auto i = find(name);
+            if (i == npos)
+                throw runtime_error("no buffer named " + string(name));
+            return child(i);
+        }
+
+        // Returns true if the byte stream ends with a checksum table 
+        bool has_checksums() const { return !checksums().empty(); }
+
+        // Checks the named buffer at the given index against its checksum, the first time it is requested, and returns false if it doesn't match.
+        // Returns true if the byte stream has no checksum table. 
+        bool verify(size_t i) const {
+            const auto& table = checksums();
+            if (i >= num_buffers())
+                throw out_of_range("buffer index out of range");
+            if (table.empty() || i + 1 == num_buffers())
+                return true;
+            {
+                lock_guard<mutex> lock(lazy->swap_lock);
+                if (lazy->verified[i])
+                    return true;
+            }
+            auto r = buffer(i);
+            auto ok = crc32c(r.begin(), r.size()) == table[i];
+            // A buffer can be verified, then converted in place, by another thread while this one is reading it 
+            lock_guard<mutex> lock(lazy->swap_lock);
+            if (ok)
+                lazy->verified[i] = 1;
+            return ok || lazy->verified[i];
+        }
+
+        // Checks every named buffer against its checksum, on multiple threads, and returns false if any of them doesn't match 
+        bool verify_all(const ParallelOptions& options = ParallelOptions()) const {
+            atomic<bool> ok(true);
+            parallel_for(num_buffers(), options.num_threads, [&](size_t i) {
+                if (!verify(i))
+                    ok = false;
+            });
+            return ok;
+        }
+
+        // Asks the operating system to start reading the pages of the named buffer at the given index, 
+        // so that loading the next buffer can overlap with processing the current one. Returns false if the hint was not accepted. 
+        bool prefetch(size_t i) const { return advise(i, access_will_need); }
+
+        // Asks the operating system to start reading the pages of the first buffer with the given name 
+        bool prefetch(string_view name) const {
+            auto i = find(name);
+            if (i == npos)
+                throw runtime_error("no buffer named " + string(name));
+            return prefetch(i);
+        }
+
+        // Passes a hint of how the named buffer at the given index is going to be accessed, for exactly the pages that it spans 
+        bool advise(size_t i, AccessPattern pattern) const {
+            auto r = buffer(i);
+            return bfast::advise(r.begin(), r.size(), pattern);
+        }
+
+        // Passes a hint of how the whole byte stream is going to be accessed 
+        bool advise(AccessPattern pattern) const { return bfast::advise(data, size, pattern); }
+
+        // Maps the pages of the header, the array offsets and the names buffer, so that the first lookups don't fault 
+        void prefault_metadata() const {
+            if (num_arrays() == 0)
+                return;
+            auto table_end = array_offsets_start + num_arrays() * sizeof(ArrayOffset);
+            auto r = names();
+            bfast::advise(data, table_end, access_will_need);
+            bfast::advise(r.begin(), r.size(), access_will_need);
+            prefault(data, table_end);
+            prefault(r.begin(), r.size());
+        }
+
+        // Returns the range of the named buffer at the given index, after checking it against its checksum, and throws an exception if it doesn't match 
+        ByteRange checked_buffer(size_t i) const {
+            if (!verify(i))
+                throw runtime_error("checksum mismatch in buffer " + std::to_string(i));
+            return buffer(i);
+        }
+
+        // Returns the named buffer at the given index as an array of T, which must be a scalar type if the stream has a different endianness.
+        // In that case the elements are converted to native byte order in place, the first time the buffer is requested,
+        // and the buffer is checked against its checksum first, if there is one. 
+        template<typename T>
+        TypedRange<T> native_buffer(size_t i) const {
+            auto r = buffer(i).as<T>();
+            if (!is_swapped || sizeof(T) == 1)
+                return r;
+            if (!verify(i))
+                throw runtime_error("checksum mismatch in buffer " + std::to_string(i));
+            lock_guard<mutex> lock(lazy->swap_lock);
+            if (!lazy->swapped_in_place[i + 1]) {
+                byte_swap<sizeof(T)>(r.begin(), r.begin(), r.size());
+                lazy->swapped_in_place[i + 1] = 1;
+            }
+            return r;
+        }
+
+        // Copies the elements of the named buffer at the given index into dst, converted to native byte order. 
+        // The destination must have room for the whole buffer. T is the scalar element type, which determines the width of the byte swap.
+        template<typename T>
+        void copy_native(size_t i, T* dst) const {
+            auto r = buffer(i);
+            check_element_size<T>(r);
+            bool swap = is_swapped && sizeof(T) > 1;
+            if (swap) {
+                lock_guard<mutex> lock(lazy->swap_lock);
+                swap = !lazy->swapped_in_place[i + 1];
+            }
+            if (swap)
+                byte_swap<sizeof(T)>(r.begin(), dst, r.size() / sizeof(T));
+            else
+                memcpy(dst, r.begin(), r.size());
+        }
+
+    private:
+        Header native_header = {};
+        const ArrayOffset* native_offsets = nullptr;
+        bool is_swapped = false;
+
+        // State that is computed on demand, and shared by all copies of a view 
+        struct LazyState { 
+            once_flag names_built; 
+            NameIndex name_index; 
+            vector<ArrayOffset> native_offsets; 
+            mutex swap_lock; 
+            vector<uint8_t> swapped_in_place;
+            once_flag checksums_read;
+            vector<uint32_t> checksums;
+            vector<uint8_t> verified;
+            once_flag name_offsets_read;
+            const ulong* name_offsets = nullptr;
+            vector<ulong> native_name_offsets;
+        };
+        shared_ptr<LazyState> lazy = make_shared<LazyState>();
+
+        // Returns the name offsets table, in native byte order, which is found on first use by looking at the end of the names buffer, 
+        // or nullptr if there is none or it doesn't match the names 
+        const ulong* name_offsets() const {
+            call_once(lazy->name_offsets_read, [this]() {
+                auto n = num_buffers();
+                if (n == 0)
+                    return;
+                auto r = names();
+                auto ends_with = [&](string_view suffix) {
+                    return r.size() >= suffix.size() && memcmp(r.end() - suffix.size(), suffix.data(), suffix.size()) == 0;
+                };
+                auto table = string(name_offsets_table_name) + '\0';
+                size_t i;
+                if (ends_with(table))
+                    i = n - 1;
+                else if (n >= 2 && ends_with(table + checksum_table_name + '\0'))
+                    i = n - 2;
+                else
+                    return;
+                auto b = buffer(i);
+                if (b.size() != (n + 1) * sizeof(ulong))
+                    return;
+                if (is_swapped) {
+                    lazy->native_name_offsets.resize(n + 1);
+                    byte_swap<sizeof(ulong)>(b.begin(), lazy->native_name_offsets.data(), n + 1);
+                    lazy->name_offsets = lazy->native_name_offsets.data();
+                }
+                else if ((uintptr_t)b.begin() % alignof(ulong) == 0) {
+                    lazy->name_offsets = (const ulong*)b.begin();
+                }
+                else {
+                    lazy->native_name_offsets.resize(n + 1);
+                    memcpy(lazy->native_name_offsets.data(), b.begin(), b.size());
+                    lazy->name_offsets = lazy->native_name_offsets.data();
+                }
+                // The table is only used if the null characters of the names are exactly where it says the names end, 
+                // so that it gives the same names as the name index 
+                auto offsets = lazy->name_offsets;
+                size_t found = 0;
+                auto matches = offsets[0] == 0 && offsets[n] == r.size() && for_each_nul((const char*)r.begin(), r.size(), [&](size_t i) {
+                    return found < n && offsets[found] < offsets[found + 1] && offsets[++found] == i + 1;
+                }) && found == n;
+                if (!matches)
+                    lazy->name_offsets = nullptr;
+            });
+            return lazy->name_offsets;
+        }
+
+        // Returns the checksums of the named buffers, in native byte order, which are read on first use, or an empty vector if there are none 
+        const vector<uint32_t>& checksums() const {
+            call_once(lazy->checksums_read, [this]() {
+                auto n = num_buffers();
+                if (n == 0 || name(n - 1) != checksum_table_name)
+                    return;
+                auto r = buffer(n - 1);
+                if (r.size() != n * sizeof(uint32_t))
+                    throw runtime_error("the checksum table does not have one entry per buffer");
+                lazy->checksums.resize(n);
+                if (is_swapped)
+                    byte_swap<sizeof(uint32_t)>(r.begin(), lazy->checksums.data(), n);
+                else
+                    memcpy(lazy->checksums.data(), r.begin(), r.size());
+                lazy->verified.resize(n);
+            });
+            return lazy->checksums;
+        }
+
+        template<typename T>
+        static void check_element_size(const ByteRange& r) {
+            if (r.size() % sizeof(T) != 0)
+                throw runtime_error("buffer size is not a multiple of the element size");
+        }
+    };
+
+    inline BfastView ByteRange::as_bfast() const {
+        return BfastView(begin(), size());
+    }
+
+    // Options for memory mapping a BFAST file 
+    struct MapOptions {
+        // How the file is going to be accessed, passed as a hint for the whole mapping 
+        AccessPattern access = access_normal;
+        // Maps the pages of the header, the array offsets and the names buffer when the file is opened 
+        bool prefault_metadata = false;
+    };
+
+    // Memory maps a BFAST file and validates it. The returned view keeps the mapping alive. 
+    inline BfastView open_mapped(const string& path, const MapOptions& options = MapOptions())
+    {
+        auto mapping = make_shared<MappedFile>(path);
+        BfastView r(mapping->data, mapping->size, mapping);
+        if (options.access != access_normal)
+            r.advise(options.access);
+        if (options.prefault_metadata)
+            r.prefault_metadata();
+        return r;
+    }
+
+    // A destination for a BFAST byte stream, which receives consecutive chunks of bytes 
+    typedef function<void(const byte*, size_t)> ByteSink;
+
+    // Creates a byte sink that writes to an output stream 
+    inline ByteSink ostream_sink(ostream& out)
+    {
+        return [&out](const byte* data, size_t size) {
+            out.write((const char*)data, (streamsize)size);
+            if (!out)
+                throw runtime_error("failed to write to output stream");
+        };
+    }
+
+#ifdef _WIN32
+    // Creates a byte sink that writes to a file handle 
+    inline ByteSink handle_sink(HANDLE handle)
+    {
+        return [handle](const byte* data, size_t size) {
+            while (size > 0) {
+                auto chunk = (DWORD)min(size, (size_t)1 << 30);
+                DWORD written = 0;
+                if (!WriteFile(handle, data, chunk, &written, nullptr))
+                    throw runtime_error("failed to write to file handle");
+                data += written;
+                size -= written;
+            }
+        };
+    }
+#else
+    // Creates a byte sink that writes to a file descriptor, such as a file, pipe, or socket 
+    inline ByteSink fd_sink(int fd)
+    {
+        return [fd](const byte* data, size_t size) {
+            while (size > 0) {
+                auto written = ::write(fd, data, size);
+                if (written < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw runtime_error("failed to write to file descriptor");
+                }
+                data += written;
+                size -= (size_t)written;
+            }
+        };
+    }
+#endif
+
+    // Writes a BFAST to a byte sink as it is produced, without materializing it in memory. 
+    // The sizes of the buffers must be known up front: the header, array offsets, and names are written on construction,
+    // then the bytes of each buffer are pushed in order, in chunks of any size, and the padding between buffers is added automatically.
+    // Optionally the buffers are checksummed as they are written, and the checksum table is written after the last one.  
+    struct BfastStreamWriter
+    {
+        BfastStreamWriter(ByteSink sink, const vector<string>& names, const vector<size_t>& sizes, bool with_checksums = false)
+            : sink(std::move(sink))
+        {
+            if (names.size() != sizes.size())
+                throw runtime_error("the number of buffer names is not equal to the number of buffer sizes");
+
+            string name_data;
+            for (const auto& name : names)
+                name_data += name + '\0';
+            vector<size_t> array_sizes = { name_data.size() };
+            array_sizes.insert(array_sizes.end(), sizes.begin(), sizes.end());
+            if (with_checksums) {
+                name_data += string(checksum_table_name) + '\0';
+                array_sizes[0] = name_data.size();
+                checksums.resize(names.size() + 1);
+                array_sizes.push_back(checksums.size() * sizeof(uint32_t));
+            }
+            offsets = compute_offsets(array_sizes);
+
+            Header h;
+            h.magic = MAGIC;
+            h.num_arrays = offsets.size();
+            h.data_start = offsets.front()._begin;
+            h.data_end = offsets.back()._end;
+
+            emit((const byte*)&h, sizeof(h));
+            pad_to(array_offsets_start);
+            emit((const byte*)offsets.data(), offsets.size() * sizeof(ArrayOffset));
+            pad_to(h.data_start);
+            emit((const byte*)name_data.data(), name_data.size());
+            advance();
+        }
+
+        // Writes the next chunk of bytes of the current buffer, a chunk cannot extend past the end of the current buffer 
+        void write(const byte* data, size_t size) {
+            if (size > remaining())
+                throw runtime_error("more bytes written than the size of the buffer");
+            if (!checksums.empty())
+                checksums[current_buffer()] = crc32c(data, size, checksums[current_buffer()]);
+            emit(data, size);
+            advance();
+        }
+
+        // Returns true once every buffer has been completely written 
+        bool done() const { return index == offsets.size(); }
+
+        // The index of the named buffer currently being written 
+        size_t current_buffer() const { return index - 1; }
+
+        // The number of bytes still expected for the current buffer 
+        size_t remaining() const { return done() ? 0 : (size_t)(offsets[index]._end - position); }
+
+        // The number of bytes written to the sink so far 
+        size_t bytes_written() const { return position; }
+
+        // Checks that every buffer has been completely written 
+        void finish() {
+            if (!done())
+                throw runtime_error("not all buffers were completely written");
+        }
+
+    private:
+        ByteSink sink;
+        vector<ArrayOffset> offsets;
+        vector<uint32_t> checksums;
+        size_t position = 0;
+        size_t index = 0;
+
+        void emit(const byte* data, size_t size) {
+            if (size == 0)
+                return;
+            sink(data, size);
+            position += size;
+        }
+
+        void pad_to(size_t target) {
+            static const byte zeros[alignment] = {};
+            assert(target >= position);
+            while (position < target)
+                emit(zeros, min(target - position, (size_t)alignment));
+        }
+
+        // Moves past every completed buffer, adding the padding up to the beginning of the next one, and the checksum table once it is reached 
+        void advance() {
+            while (!done() && position == offsets[index]._end) {
+                if (++index < offsets.size())
+                    pad_to(offsets[index]._begin);
+                if (!checksums.empty() && index + 1 == offsets.size())
+                    emit((const byte*)checksums.data(), checksums.size() * sizeof(uint32_t));
+            }
+        }
+    };
+
+    // Writes a BFAST to a byte sink, calling on_buffer for each buffer in order with the writer, the buffer index, name, and size.
+    // The callback is expected to write exactly size bytes of the buffer to the writer. 
+    inline void write_bfast(ByteSink sink, const vector<string>& names, const vector<size_t>& sizes,
+        const function<void(BfastStreamWriter&, size_t, const string&, size_t)>& on_buffer, bool with_checksums = false)
+    {
+        BfastStreamWriter writer(std::move(sink), names, sizes, with_checksums);
+        for (size_t i = 0; i < names.size(); ++i) {
+            on_buffer(writer, i, names[i], sizes[i]);
+            if (!writer.done() && writer.current_buffer() <= i)
+                throw runtime_error("buffer " + names[i] + " was not completely written");
+        }
+        writer.finish();
+    }
+
+    // Returns the consecutive blocks of memory that make up the byte stream of a BFAST without copying the buffers:
+    // the header block (stored in header_block), then each buffer followed by its padding, which points to static zero bytes.
+    inline vector<pair<const byte*, size_t>> gather_blocks(BfastRawData& data, vector<byte>& header_block)
+    {
+        static const byte zeros[alignment] = {};
+        auto layout = data.compute_layout();
+        const auto& offsets = layout.offsets;
+        header_block.resize((size_t)layout.header.data_start);
+        layout.write_header(header_block.data());
+
+        vector<pair<const byte*, size_t>> r;
+        r.push_back({ header_block.data(), header_block.size() });
+        auto written = layout.header.data_start;
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            if (layout.source(i) != i)
+                continue;
+            if (offsets[i]._begin > written)
+                r.push_back({ zeros, (size_t)(offsets[i]._begin - written) });
+            if (data.ranges[i].size() > 0)
+                r.push_back({ data.ranges[i].begin(), data.ranges[i].size() });
+            written = offsets[i]._end;
+        }
+        return r;
+    }
+
+#ifdef _WIN32
+    // Writes a BFAST to a file handle directly from the buffers, without packing it in memory first. 
+    // WriteFileGather requires unbuffered, page-aligned and page-sized segments, which arbitrary buffers are not, so the blocks are written one after the other. 
+    inline void write_handle(HANDLE handle, BfastRawData& data)
+    {
+        vector<byte> header_block;
+        auto sink = handle_sink(handle);
+        for (const auto& block : gather_blocks(data, header_block))
+            sink(block.first, block.second);
+    }
+
+    // Writes a BFAST to a file directly from the buffers, without packing it in memory first 
+    inline void write_file(const string& path, BfastRawData& data)
+    {
+        HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            throw runtime_error("could not create file " + path);
+        try {
+            write_handle(handle, data);
+        }
+        catch (...) {
+            CloseHandle(handle);
+            throw;
+        }
+        CloseHandle(handle);
+    }
+#else
+    // Writes a BFAST to a file descriptor with vectored I/O (writev), directly from the buffers, without packing it in memory first.
+    // The blocks are submitted in batches of at most IOV_MAX, and partial writes are resumed. 
+    inline void write_fd(int fd, BfastRawData& data)
+    {
+        vector<byte> header_block;
+        auto blocks = gather_blocks(data, header_block);
+        vector<iovec> iov(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i)
+            iov[i] = { (void*)blocks[i].first, blocks[i].second };
+
+        size_t first = 0;
+        while (first < iov.size()) {
+            auto count = (int)min(iov.size() - first, (size_t)IOV_MAX);
+            auto written = ::writev(fd, &iov[first], count);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw runtime_error("failed to write to file descriptor");
+            }
+            // Skip the blocks that were completely written, and move the start of a partially written block 
+            auto n = (size_t)written;
+            while (first < iov.size() && n >= iov[first].iov_len) {
+                n -= iov[first].iov_len;
+                ++first;
+            }
+            if (n > 0) {
+                iov[first].iov_base = (byte*)iov[first].iov_base + n;
+                iov[first].iov_len -= n;
+            }
+        }
+    }
+
+    // Writes a BFAST to a file directly from the buffers, without packing it in memory first 
+    inline void write_file(const string& path, BfastRawData& data)
+    {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw runtime_error("could not create file " + path);
+        try {
+            write_fd(fd, data);
+        }
+        catch (...) {
+            ::close(fd);
+            throw;
+        }
+        if (::close(fd) != 0)
+            throw runtime_error("failed to close file " + path);
+    }
+#endif
+
+    // Writes a BFAST to a file directly from the buffers, without packing it in memory first 
+    inline void write_file(const string& path, BfastData& data)
+    {
+        string name_data;
+        auto raw = data.to_raw_data(name_data);
+        write_file(path, raw);
+    }
+
+    // A source of bytes that can be read at arbitrary offsets, such as a file or an object in remote storage 
+    struct RandomAccessSource
+    {
+        virtual ~RandomAccessSource() = default;
+
+        // The total number of bytes in the source 
+        virtual ulong size() const = 0;
+
+        // Reads exactly size bytes starting at the given offset into dst, and throws an exception if they can't be read 
+        virtual void read(ulong offset, byte* dst, size_t size) = 0;
+    };
+
+    // The alignment of the file offsets, sizes and memory of direct reads, which is a multiple of the logical block size of common devices 
+    const size_t direct_io_alignment = 4096;
+
+    // A random access source that reads from a file using positional reads 
+    struct FileSource : RandomAccessSource
+    {
+        // Opens a file. When direct is true the page cache is bypassed (O_DIRECT, F_NOCACHE or FILE_FLAG_NO_BUFFERING),
+        // and every read must then use an offset, size and destination aligned to direct_io_alignment. 
+        // If the file system doesn't support direct I/O the file is opened normally, and is_direct() returns false. 
+        explicit FileSource(const string& path, bool direct = false)
+        {
+#ifdef _WIN32
+            auto flags = direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_RANDOM_ACCESS;
+            handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+            if (handle == INVALID_HANDLE_VALUE && direct) {
+                direct = false;
+                handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+            }
+            if (handle == INVALID_HANDLE_VALUE)
+                throw runtime_error("could not open file " + path);
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(handle, &file_size)) {
+                CloseHandle(handle);
+                throw runtime_error("could not get size of file " + path);
+            }
+            length = (ulong)file_size.QuadPart;
+#else
+#if defined(O_DIRECT)
+            fd = ::open(path.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+            if (fd < 0 && direct && errno == EINVAL) {
+                direct = false;
+                fd = ::open(path.c_str(), O_RDONLY);
+            }
+#else
+            fd = ::open(path.c_str(), O_RDONLY);
+#if defined(F_NOCACHE)
+            if (fd >= 0 && direct)
+                direct = fcntl(fd, F_NOCACHE, 1) == 0;
+#else
+            direct = false;
+#endif
+#endif
+            if (fd < 0)
+                throw runtime_error("could not open file " + path);
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw runtime_error("could not get size of file " + path);
+            }
+            length = (ulong)st.st_size;
+#endif
+            this->direct = direct;
+        }
+
+        ~FileSource() override
+        {
+#ifdef _WIN32
+            CloseHandle(handle);
+#else
+            ::close(fd);
+#endif
+        }
+
+        FileSource(const FileSource&) = delete;
+        FileSource& operator=(const FileSource&) = delete;
+
+        ulong size() const override { return length; }
+
+        // Whether the file was opened for direct I/O 
+        bool is_direct() const { return direct; }
+
+        // Reads the given range. A direct read may extend past the end of the file up to the next aligned offset, and stops at the end. 
+        void read(ulong offset, byte* dst, size_t size) override
+        {
+            while (size > 0) {
+#ifdef _WIN32
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = (DWORD)offset;
+                overlapped.OffsetHigh = (DWORD)(offset >> 32);
+                DWORD n = 0;
+                if (!ReadFile(handle, dst, (DWORD)min(size, (size_t)1 << 30), &n, &overlapped) && GetLastError() != ERROR_HANDLE_EOF)
+                    throw runtime_error("failed to read from file");
+#else
+                auto n = ::pread(fd, dst, size, (off_t)offset);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw runtime_error("failed to read from file");
+                }
+#endif
+                if (n == 0 && !(direct && offset >= length))
+                    throw runtime_error("unexpected end of file");
+                dst += n;
+                offset += n;
+                size -= (size_t)n;
+                if (direct && offset >= length)
+                    return;
+            }
+        }
+
+#ifdef _WIN32
+        HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+        int fd = -1;
+#endif
+
+    private:
+        ulong length = 0;
+        bool direct = false;
+    };
+
+    // A random access source that reads by calling a user function, such as one that issues HTTP range requests or S3 GETs 
+    struct CallbackSource : RandomAccessSource
+    {
+        typedef function<void(ulong offset, byte* dst, size_t size)> ReadFunction;
+
+        CallbackSource(ulong size, ReadFunction callback)
+            : source_size(size), callback(std::move(callback))
+        { }
+
+        ulong size() const override { return source_size; }
+        void read(ulong offset, byte* dst, size_t size) override { callback(offset, dst, size); }
+
+    private:
+        ulong source_size;
+        ReadFunction callback;
+    };
+
+    // Reads a BFAST from a random access source on demand. On construction only the header, the array offsets, and the names are read,
+    // and each buffer is fetched the first time it is requested. Fetches of several buffers that are adjacent in the source are coalesced into single reads.
+    // The returned ranges are valid for the lifetime of the reader. The reader is not thread-safe. 
+    struct BfastLazyReader
+    {
+        static const size_t npos = NameIndex::npos;
+
+        // Requested buffers separated by at most this many bytes are fetched with a single read 
+        size_t coalesce_gap = alignment;
+
+        explicit BfastLazyReader(shared_ptr<RandomAccessSource> source)
+            : source(std::move(source))
+        {
+            auto size = this->source->size();
+            if (size < header_size)
+                throw runtime_error("not enough data for a BFast header");
+            read(0, (byte*)&h, sizeof(Header));
+            check_header(h, size);
+
+            array_offsets.resize(h.num_arrays);
+            read(array_offsets_start, (byte*)array_offsets.data(), array_offsets.size() * sizeof(ArrayOffset));
+            check_offsets(h, array_offsets.data());
+            ranges.resize(array_offsets.size(), ByteRange(nullptr, nullptr));
+            fetched.resize(array_offsets.size());
+
+            if (!array_offsets.empty()) {
+                const auto& offset = array_offsets[0];
+                names_data.resize(offset._end - offset._begin);
+                read(offset._begin, names_data.data(), names_data.size());
+            }
+            index = NameIndex((const char*)names_data.data(), names_data.size(), num_buffers());
+        }
+
+        BfastLazyReader(const BfastLazyReader&) = delete;
+        BfastLazyReader& operator=(const BfastLazyReader&) = delete;
+
+        const Header& header() const { return h; }
+        const vector<ArrayOffset>& offsets() const { return array_offsets; }
+
+        // The number of named buffers, not counting the names buffer 
+        size_t num_buffers() const { return array_offsets.empty() ? 0 : array_offsets.size() - 1; }
+
+        // Returns the name of the buffer at the given index 
+        string_view name(size_t i) const { return index.name(i); }
+
+        // Returns the index of the first buffer with the given name, or npos if there is none 
+        size_t find(string_view name) const { return index.find(name); }
+
+        // Returns the named buffer at the given index, fetching it if necessary 
+        ByteRange get(size_t i) {
+            fetch({ i });
+            return ranges[i + 1];
+        }
+
+        // Returns the first buffer with the given name, fetching it if necessary 
+        ByteRange get(string_view name) {
+            auto i = find(name);
+            if (i == npos)
+                throw runtime_error("no buffer named " + string(name));
+            return get(i);
+        }
+
+        // Fetches the named buffers with the given indices that have not been fetched yet, coalescing the reads of buffers that are close together
+        void fetch(vector<size_t> indices) {
+            for (auto& i : indices) {
+                if (i >= num_buffers())
+                    throw out_of_range("buffer index out of range");
+                i += 1;
+            }
+            indices.erase(remove_if(indices.begin(), indices.end(), [&](size_t i) { return fetched[i] != 0; }), indices.end());
+            sort(indices.begin(), indices.end(), [&](size_t a, size_t b) { return array_offsets[a]._begin < array_offsets[b]._begin || (array_offsets[a]._begin == array_offsets[b]._begin && a < b); });
+            indices.erase(unique(indices.begin(), indices.end()), indices.end());
+
+            size_t first = 0;
+            while (first < indices.size()) {
+                auto last = first;
+                auto end = array_offsets[indices[first]]._end;
+                while (last + 1 < indices.size() && array_offsets[indices[last + 1]]._begin <= end + coalesce_gap) {
+                    ++last;
+                    end = max(end, array_offsets[indices[last]]._end);
+                }
+                auto begin = array_offsets[indices[first]]._begin;
+                blocks.emplace_back(new byte[max((size_t)(end - begin), (size_t)1)]);
+                auto block = blocks.back().get();
+                read(begin, block, end - begin);
+                for (auto j = first; j <= last; ++j) {
+                    const auto& offset = array_offsets[indices[j]];
+                    ranges[indices[j]] = ByteRange(block + (offset._begin - begin), block + (offset._end - begin));
+                    fetched[indices[j]] = 1;
+                }
+                first = last + 1;
+            }
+        }
+
+        // The total number of bytes read from the source so far 
+        size_t bytes_read() const { return total_read; }
+
+        // The number of read requests issued to the source so far 
+        size_t read_count() const { return num_reads; }
+
+    private:
+        shared_ptr<RandomAccessSource> source;
+        Header h = {};
+        vector<ArrayOffset> array_offsets;
+        vector<byte> names_data;
+        NameIndex index;
+        vector<ByteRange> ranges;
+        vector<uint8_t> fetched;
+        vector<unique_ptr<byte[]>> blocks;
+        size_t total_read = 0;
+        size_t num_reads = 0;
+
+        void read(ulong offset, byte* dst, size_t size) {
+            if (size == 0)
+                return;
+            source->read(offset, dst, size);
+            total_read += size;
+            num_reads++;
+        }
+    };
+
+    // Opens a BFAST file for reading buffers on demand 
+    inline unique_ptr<BfastLazyReader> open_lazy(const string& path)
+    {
+        return make_unique<BfastLazyReader>(make_shared<FileSource>(path));
+    }
+
+    // Many small BFAST containers parsed into a single structure of arrays: the array offsets of all containers are kept in one array,
+    // in native byte order, and their names in one arena, so that opening a container costs no allocation, and scanning the buffers 
+    // of many containers reads contiguous memory. Buffers are addressed by container index and buffer index, and alias the containers. 
+    struct BfastBatch
+    {
+        static const size_t npos = (size_t)-1;
+
+        // Checks that containers are laid out strictly in order, which edited and deduplicated containers aren't (see validate) 
+        bool strict = true;
+
+        BfastBatch() = default;
+        BfastBatch(BfastBatch&&) = default;
+        BfastBatch& operator=(BfastBatch&&) = default;
+
+        // Preallocates room for the given number of containers, buffers over all containers, and bytes of names 
+        void reserve(size_t num_containers, size_t num_buffers, size_t names_size) {
+            bases.reserve(num_containers);
+            sizes.reserve(num_containers);
+            swapped_flags.reserve(num_containers);
+            first_buffers.reserve(num_containers + 1);
+            buffer_offsets.reserve(num_buffers);
+            name_offsets.reserve(num_buffers + 1);
+            names.reserve(names_size);
+        }
+
+        // Validates a BFAST byte stream and adds it to the batch, returning its container index. The memory must outlive the batch. 
+        size_t add(byte* data, size_t size) {
+            auto result = validate(data, size, strict);
+            if (!result)
+                throw runtime_error("container " + std::to_string(bases.size()) + ": " + result.message());
+            auto index = bases.size();
+            Header h;
+            memcpy(&h, data, sizeof(Header));
+            bool swapped = h.magic == SWAPPED_MAGIC;
+            if (swapped)
+                byte_swap<sizeof(ulong)>(&h, &h, sizeof(Header) / sizeof(ulong));
+            auto num_arrays = (size_t)h.num_arrays;
+            auto table = (const ArrayOffset*)(data + array_offsets_start);
+            auto first = buffer_offsets.size();
+            buffer_offsets.resize(first + num_arrays - 1);
+            if (swapped)
+                byte_swap<sizeof(ulong)>(table + 1, buffer_offsets.data() + first, (num_arrays - 1) * 2);
+            else
+                memcpy(buffer_offsets.data() + first, table + 1, (num_arrays - 1) * sizeof(ArrayOffset));
+
+            // The names buffer was checked to contain a terminated name per buffer 
+            ArrayOffset names_offset = table[0];
+            if (swapped)
+                byte_swap<sizeof(ulong)>(&names_offset, &names_offset, 2);
+            auto p = (const char*)data + names_offset._begin;
+            auto base = names.size();
+            if (name_offsets.empty())
+                name_offsets.push_back(0);
+            for (size_t i = 0; i + 1 < num_arrays; ++i) {
+                auto end = (const char*)memchr(p, '\0', (size_t)(data + names_offset._end - (const byte*)p));
+                p = end + 1;
+                name_offsets.push_back((ulong)(base + (p - ((const char*)data + names_offset._begin))));
+            }
+            names.append((const char*)data + names_offset._begin, p - ((const char*)data + names_offset._begin));
+
+            if (first_buffers.empty())
+                first_buffers.push_back(0);
+            first_buffers.push_back(buffer_offsets.size());
+            bases.push_back(data);
+            sizes.push_back(size);
+            swapped_flags.push_back(swapped);
+            return index;
+        }
+
+        // Reads the given files into a single allocation, on multiple threads, and adds them in order. The batch owns the memory. 
+        static BfastBatch read_files(const vector<string>& paths, const ParallelOptions& options = ParallelOptions(), bool strict = true) {
+            vector<size_t> file_sizes(paths.size());
+            vector<size_t> file_offsets(paths.size() + 1);
+            for (size_t i = 0; i < paths.size(); ++i) {
+                file_sizes[i] = file_size(paths[i]);
+                file_offsets[i + 1] = aligned_value(file_offsets[i] + file_sizes[i]);
+            }
+            BfastBatch r;
+            r.strict = strict;
+            r.storage = AlignedBuffer(file_offsets.back());
+            parallel_for(paths.size(), options.num_threads, [&](size_t i) {
+                FileSource file(paths[i]);
+                if (file.size() != file_sizes[i])
+                    throw runtime_error("file " + paths[i] + " changed size while it was read");
+                file.read(0, r.storage.data() + file_offsets[i], file_sizes[i]);
+            });
+            r.reserve(paths.size(), 0, 0);
+            for (size_t i = 0; i < paths.size(); ++i) {
+                try {
+                    r.add(r.storage.data() + file_offsets[i], file_sizes[i]);
+                }
+                catch (const runtime_error& e) {
+                    throw runtime_error("file " + paths[i] + ": " + e.what());
+                }
+            }
+            return r;
+        }
+
+        // The number of containers 
+        size_t num_containers() const { return bases.size(); }
+
+        // The number of named buffers of a container 
+        size_t num_buffers(size_t c) const { return first_buffer(c + 1) - first_buffer(c); }
+
+        // The number of named buffers of all containers 
+        size_t total_buffers() const { return buffer_offsets.size(); }
+
+        // The index in offsets() of the first buffer of a container, or total_buffers() for num_containers() 
+        size_t first_buffer(size_t c) const { return first_buffers.empty() ? 0 : (size_t)first_buffers[c]; }
+
+        // The array offsets of the named buffers of all containers, relative to the beginning of their container, in native byte order 
+        const ArrayOffset* offsets() const { return buffer_offsets.data(); }
+
+        // The byte stream of a container 
+        ByteRange container(size_t c) const { return ByteRange(bases[c], bases[c] + sizes[c]); }
+
+        // Returns true if a container was written with a different endianness, in which case its buffers are not converted 
+        bool swapped(size_t c) const { return swapped_flags[c] != 0; }
+
+        // Returns the named buffer b of container c 
+        ByteRange buffer(size_t c, size_t b) const {
+            if (b >= num_buffers(c))
+                throw out_of_range("buffer index out of range");
+            const auto& offset = buffer_offsets[first_buffer(c) + b];
+            return ByteRange(bases[c] + offset._begin, bases[c] + offset._end);
+        }
+
+        // Returns the name of buffer b of container c 
+        string_view name(size_t c, size_t b) const {
+            if (b >= num_buffers(c))
+                throw out_of_range("buffer index out of range");
+            auto i = first_buffer(c) + b;
+            return string_view(names.data() + name_offsets[i], (size_t)(name_offsets[i + 1] - name_offsets[i] - 1));
+        }
+
+        // Returns the index of the first buffer of container c with the given name, or npos. 
+        // The names of the container are compared in order, which is fastest for the few buffers of a small container. 
+        size_t find(size_t c, string_view name) const {
+            for (size_t b = 0, n = num_buffers(c); b < n; ++b)
+                if (this->name(c, b) == name)
+                    return b;
+            return npos;
+        }
+
+        // Returns a view of a container, which is only valid as long as the batch 
+        BfastView view(size_t c) const { return BfastView(bases[c], sizes[c]); }
+
+    private:
+        AlignedBuffer storage;
+        vector<byte*> bases;
+        vector<size_t> sizes;
+        vector<uint8_t> swapped_flags;
+        vector<ulong> first_buffers;
+        vector<ArrayOffset> buffer_offsets;
+        vector<ulong> name_offsets;
+        string names;
+
+        static size_t file_size(const string& path) {
+#ifdef _WIN32
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+                throw runtime_error("could not get size of file " + path);
+            return (size_t)(((ulong)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow);
+#else
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+                throw runtime_error("could not get size of file " + path);
+            return (size_t)st.st_size;
+#endif
+        }
+    };
+
+    // Edits a BFAST file in place, so that changing a buffer doesn't require rewriting the whole file. A buffer is overwritten where it is
+    // when its new contents fit, and is otherwise appended at the end of the file. New buffers can be added when the file was written with 
+    // reserved array offsets (see BfastData::reserved_arrays). Overwrites in place are visible immediately, while appended buffers and new sizes
+    // become visible when commit() writes the array offsets and the header. The space of a buffer that was moved is not reclaimed. 
+    // Buffers of an edited file may be out of order, which validate() only accepts when it isn't strict.
+    // When the file ends with a checksum table, the checksums of replaced and added buffers are updated, and the table is kept last. 
+    // The names and the checksum table are never overwritten: commit() writes the ones that changed at the end of the file. 
+    struct BfastEditor
+    {
+        static const size_t npos = (size_t)-1;
+
+        explicit BfastEditor(const string& path)
+        {
+#ifdef _WIN32
+            handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+            if (handle == INVALID_HANDLE_VALUE)
+                throw runtime_error("could not open file " + path);
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(handle, &file_size)) {
+                CloseHandle(handle);
+                throw runtime_error("could not get size of file " + path);
+            }
+            file_end = (ulong)file_size.QuadPart;
+#else
+            fd = ::open(path.c_str(), O_RDWR);
+            if (fd < 0)
+                throw runtime_error("could not open file " + path);
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw runtime_error("could not get size of file " + path);
+            }
+            file_end = (ulong)st.st_size;
+#endif
+            try {
+                if (file_end < header_size)
+                    throw runtime_error("not enough data for a BFast header");
+                read_at(0, (byte*)&h, sizeof(Header));
+                check_header(h, (size_t)file_end);
+                if (h.num_arrays == 0)
+                    throw runtime_error("there is no names buffer");
+                offsets.resize((size_t)h.num_arrays);
+                read_at(array_offsets_start, (byte*)offsets.data(), offsets.size() * sizeof(ArrayOffset));
+                check_offsets(h, offsets.data());
+
+                vector<byte> name_data(buffer_size_of(0));
+                read_at(offsets[0]._begin, name_data.data(), name_data.size());
+                NameIndex index((const char*)name_data.data(), name_data.size(), offsets.size() - 1);
+                for (size_t i = 0; i + 1 < offsets.size(); ++i)
+                    names.push_back(string(index.name(i)));
+
+                if (!names.empty() && names.back() == checksum_table_name) {
+                    auto a = offsets.size() - 1;
+                    if (buffer_size_of(a) != names.size() * sizeof(uint32_t))
+                        throw runtime_error("the checksum table does not have one entry per buffer");
+                    checksums.resize(names.size());
+                    read_at(offsets[a]._begin, (byte*)checksums.data(), buffer_size_of(a));
+                }
+            }
+            catch (...) {
+                close();
+                throw;
+            }
+        }
+
+        ~BfastEditor() { close(); }
+
+        BfastEditor(const BfastEditor&) = delete;
+        BfastEditor& operator=(const BfastEditor&) = delete;
+
+        // The number of named buffers, not counting the names buffer 
+        size_t num_buffers() const { return names.size(); }
+
+        // Returns the name of the buffer at the given index 
+        const string& name(size_t i) const { return names.at(i); }
+
+        // Returns the index of the first buffer with the given name, or npos if there is none 
+        size_t find(string_view name) const {
+            for (size_t i = 0; i < names.size(); ++i)
+                if (names[i] == name)
+                    return i;
+            return npos;
+        }
+
+        // The number of buffers that can still be added 
+        size_t reserved_arrays() const {
+            return (size_t)(h.data_start - array_offsets_start) / array_offset_size - offsets.size();
+        }
+
+        // Returns the size in bytes of the named buffer at the given index 
+        size_t buffer_size(size_t i) const { return buffer_size_of(array_index(i)); }
+
+        // Returns the number of bytes that can be written to the named buffer at the given index without moving it 
+        size_t capacity(size_t i) const { return capacity_of(array_index(i)); }
+
+        // Reads the current contents of the named buffer at the given index 
+        vector<byte> get(size_t i) {
+            auto a = array_index(i);
+            vector<byte> r(buffer_size_of(a));
+            read_at(offsets[a]._begin, r.data(), r.size());
+            return r;
+        }
+
+        // Returns true if the file ends with a checksum table, which the editor keeps up to date 
+        bool has_checksums() const { return !checksums.empty(); }
+
+        // Replaces the contents of the named buffer at the given index, in place if they fit, and otherwise at the end of the file 
+        void replace(size_t i, const byte* data, size_t size) {
+            auto a = array_index(i);
+            if (has_checksums() && i + 1 == names.size())
+                throw runtime_error("the checksum table can't be replaced");
+            offsets[a] = place(a, data, size);
+            if (has_checksums()) {
+                checksums[i] = crc32c(data, size);
+                checksums_changed = true;
+            }
+        }
+
+        // Adds a named buffer, using one of the reserved array offsets, and returns its index.
+        // In a file with a checksum table, the buffer is inserted before the table. 
+        size_t add(const string& name, const byte* data, size_t size) {
+            if (reserved_arrays() == 0)
+                throw runtime_error("there is no reserved array offset left, the file must be rewritten to add buffers");
+            if (name.find('\0') != string::npos)
+                throw runtime_error("buffer names cannot contain null characters");
+            if (find(compression_table_name) != npos)
+                throw runtime_error("buffers can't be added to a compressed file, the file must be rewritten");
+            auto i = has_checksums() ? names.size() - 1 : names.size();
+            offsets.insert(offsets.begin() + (i + 1), append(data, size));
+            names.insert(names.begin() + i, name);
+            names_changed = true;
+            if (has_checksums()) {
+                checksums.insert(checksums.begin() + i, crc32c(data, size));
+                checksums_changed = true;
+            }
+            return i;
+        }
+
+        // Writes the names and the checksum table if they changed, then the array offsets and the header, which makes the changes visible to readers 
+        void commit() {
+            if (names_changed) {
+                string name_data;
+                for (const auto& n : names)
+                    name_data += n + '\0';
+                offsets[0] = append((const byte*)name_data.data(), name_data.size());
+            }
+            if (checksums_changed)
+                offsets.back() = append((const byte*)checksums.data(), checksums.size() * sizeof(uint32_t));
+            names_changed = checksums_changed = false;
+            h.num_arrays = offsets.size();
+            h.data_end = h.data_start;
+            for (const auto& offset : offsets)
+                h.data_end = max(h.data_end, offset._end);
+            write_at(array_offsets_start, (const byte*)offsets.data(), offsets.size() * sizeof(ArrayOffset));
+            write_at(0, (const byte*)&h, sizeof(Header));
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+        int fd = -1;
+#endif
+        Header h = {};
+        vector<ArrayOffset> offsets;
+        vector<string> names;
+        vector<uint32_t> checksums;
+        bool names_changed = false;
+        bool checksums_changed = false;
+        ulong file_end = 0;
+
+        void close() {
+#ifdef _WIN32
+            if (handle != INVALID_HANDLE_VALUE)
+                CloseHandle(handle);
+            handle = INVALID_HANDLE_VALUE;
+#else
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+#endif
+        }
+
+        size_t array_index(size_t i) const {
+            if (i >= names.size())
+                throw out_of_range("buffer index out of range");
+            return i + 1;
+        }
+
+        size_t buffer_size_of(size_t a) const { return (size_t)(offsets[a]._end - offsets[a]._begin); }
+
+        // The bytes from the beginning of an array up to the beginning of the next array, or without limit for the last one.
+        // An array that shares bytes with another one can't be overwritten in place. 
+        size_t capacity_of(size_t a) const {
+            if (a >= offsets.size())
+                return 0;
+            auto begin = offsets[a]._begin;
+            auto end = offsets[a]._end;
+            auto limit = (ulong)-1;
+            for (size_t j = 0; j < offsets.size(); ++j) {
+                if (j == a)
+                    continue;
+                const auto& other = offsets[j];
+                if (other._begin < end && other._end > begin && other._end > other._begin)
+                    return 0;
+                if (other._begin >= begin && other._end > other._begin)
+                    limit = min(limit, other._begin);
+            }
+            return limit == (ulong)-1 ? (size_t)-1 : (size_t)(limit - begin);
+        }
+
+        // Writes the contents of an array in place if they fit, and otherwise at the end of the file, and returns the new array offset 
+        ArrayOffset place(size_t a, const byte* data, size_t size) {
+            if (size > capacity_of(a))
+                return append(data, size);
+            ArrayOffset r = { offsets[a]._begin, offsets[a]._begin + size };
+            write_at(r._begin, data, size);
+            file_end = max(file_end, r._end);
+            return r;
+        }
+
+        // Writes data at the end of the file, where no reader looks until commit(), and returns its array offset 
+        ArrayOffset append(const byte* data, size_t size) {
+            ArrayOffset r;
+            r._begin = aligned_value((size_t)file_end);
+            r._end = r._begin + size;
+            write_at(r._begin, data, size);
+            file_end = r._end;
+            return r;
+        }
+
+        void read_at(ulong offset, byte* dst, size_t size) {
+            while (size > 0) {
+#ifdef _WIN32
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = (DWORD)offset;
+                overlapped.OffsetHigh = (DWORD)(offset >> 32);
+                DWORD n = 0;
+                if (!ReadFile(handle, dst, (DWORD)min(size, (size_t)1 << 30), &n, &overlapped) && GetLastError() != ERROR_HANDLE_EOF)
+                    throw runtime_error("failed to read from file");
+#else
+                auto n = ::pread(fd, dst, size, (off_t)offset);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw runtime_error("failed to read from file");
+                }
+#endif
+                if (n == 0)
+                    throw runtime_error("unexpected end of file");
+                dst += n;
+                offset += n;
+                size -= (size_t)n;
+            }
+        }
+
+        void write_at(ulong offset, const byte* data, size_t size) {
+            while (size > 0) {
+#ifdef _WIN32
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = (DWORD)offset;
+                overlapped.OffsetHigh = (DWORD)(offset >> 32);
+                DWORD n = 0;
+                if (!WriteFile(handle, data, (DWORD)min(size, (size_t)1 << 30), &n, &overlapped))
+                    throw runtime_error("failed to write to file");
+#else
+                auto n = ::pwrite(fd, data, size, (off_t)offset);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw runtime_error("failed to write to file");
+                }
+#endif
+                data += n;
+                offset += n;
+                size -= (size_t)n;
+            }
+        }
     };
 }
\ No newline at end of file
@@ -0,0 +1,652 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Asynchronous reading of BFAST files. Reads are issued in batches to an AsyncIO engine, and results are delivered through futures,
+    so a single thread can keep many files and buffers in flight. Opening a file reads the header, the array offsets and, when they fit,
+    the names with a single read, and the buffers requested together are read as one batch.
+
+    On Linux, defining BFAST_WITH_IO_URING enables an engine that submits the reads to an io_uring from a single reactor thread,
+    using the system calls directly so that liburing is not needed. Elsewhere, or if the kernel doesn't allow io_uring,
+    a pool of threads performing positional reads is used.
+
+    Buffers that are uploaded to a GPU can be read with async_read_direct() straight into the caller's pinned or mapped staging memory,
+    bypassing the page cache, so that the only copy left is the upload itself. Direct reads cover whole blocks, see DirectSpan.
+*/
+#pragma once
+
+#include "bfast.h"
+
+#include <future>
+#include <deque>
+#include <unordered_set>
+#include <condition_variable>
+
+#if defined(BFAST_WITH_IO_URING) && defined(__linux__)
+#define BFAST_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace bfast
+{
+    // A read of a range of a file into memory
+    struct AsyncRead {
+        FileSource* file;
+        ulong offset;
+        byte* dst;
+        size_t size;
+    };
+
+    // Performs batches of reads asynchronously
+    struct AsyncIO
+    {
+        // Called once every read of a batch has completed, with the first error, or null if they all succeeded
+        typedef function<void(exception_ptr)> Completion;
+
+        virtual ~AsyncIO() = default;
+
+        // Starts the reads, and calls done from an I/O thread once they have all completed. The memory being read into must stay valid until then.
+        virtual void submit(vector<AsyncRead> reads, Completion done) = 0;
+
+    protected:
+        // Tracks the reads of a batch that are still in flight
+        struct Batch {
+            vector<AsyncRead> reads;
+            Completion done;
+            atomic<size_t> remaining;
+            mutex error_lock;
+            exception_ptr error;
+
+            Batch(vector<AsyncRead> reads, Completion done)
+                : reads(std::move(reads)), done(std::move(done)), remaining(this->reads.size())
+            { }
+
+            void finish(exception_ptr e) {
+                if (e) {
+                    lock_guard<mutex> lock(error_lock);
+                    if (!error)
+                        error = e;
+                }
+                if (--remaining == 0)
+                    done(error);
+            }
+        };
+    };
+
+    // Performs reads on a pool of threads, using blocking positional reads
+    struct ThreadPoolIO : AsyncIO
+    {
+        // Creates the given number of threads, 0 uses the hardware concurrency
+        explicit ThreadPoolIO(unsigned num_threads = 0)
+        {
+            if (num_threads == 0)
+                num_threads = max(1u, thread::hardware_concurrency());
+            for (unsigned i = 0; i < num_threads; ++i)
+                threads.emplace_back([this]() { run(); });
+        }
+
+        ~ThreadPoolIO() override
+        {
+            {
+                lock_guard<mutex> lock(queue_lock);
+                stopping = true;
+            }
+            queue_changed.notify_all();
+            for (auto& t : threads)
+                t.join();
+        }
+
+        void submit(vector<AsyncRead> reads, Completion done) override
+        {
+            if (reads.empty()) {
+                done(nullptr);
+                return;
+            }
+            auto batch = make_shared<Batch>(std::move(reads), std::move(done));
+            {
+                lock_guard<mutex> lock(queue_lock);
+                for (size_t i = 0; i < batch->reads.size(); ++i)
+                    queue.push_back({ batch, i });
+            }
+            queue_changed.notify_all();
+        }
+
+    private:
+        struct Job { shared_ptr<Batch> batch; size_t index; };
+        vector<thread> threads;
+        mutex queue_lock;
+        condition_variable queue_changed;
+        deque<Job> queue;
+        bool stopping = false;
+
+        // Runs the jobs until the pool is destroyed, completing the pending ones first
+        void run() {
+            for (;;) {
+                Job job;
+                {
+                    unique_lock<mutex> lock(queue_lock);
+                    queue_changed.wait(lock, [this]() { return stopping || !queue.empty(); });
+                    if (queue.empty())
+                        return;
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                exception_ptr error;
+                try {
+                    const auto& r = job.batch->reads[job.index];
+                    r.file->read(r.offset, r.dst, r.size);
+                }
+                catch (...) {
+                    error = current_exception();
+                }
+                job.batch->finish(error);
+            }
+        }
+    };
+
+#ifdef BFAST_IO_URING
+    // Performs reads with an io_uring, from a single reactor thread which submits and reaps them in batches.
+    // The reactor sleeps in the kernel until a read completes or new reads are submitted, which are signaled through an eventfd.
+    struct UringIO : AsyncIO
+    {
+        // Creates a ring with room for the given number of reads in flight, and throws an exception if the kernel doesn't support io_uring
+        explicit UringIO(unsigned queue_depth = 256)
+        {
+            io_uring_params params = {};
+            ring_fd = (int)syscall(__NR_io_uring_setup, queue_depth, &params);
+            if (ring_fd < 0)
+                throw runtime_error("could not create io_uring");
+            sq_entries = params.sq_entries;
+            cq_entries = params.cq_entries;
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap)
+                sq_ring_size = cq_ring_size = max(sq_ring_size, cq_ring_size);
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+            sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+            cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+            sqes = (io_uring_sqe*)map(sqes_size, IORING_OFF_SQES);
+            if (sq_ring == nullptr || cq_ring == nullptr || sqes == nullptr) {
+                unmap();
+                ::close(ring_fd);
+                throw runtime_error("could not map io_uring");
+            }
+            sq_head = (unsigned*)(sq_ring + params.sq_off.head);
+            sq_tail = (unsigned*)(sq_ring + params.sq_off.tail);
+            sq_mask = *(unsigned*)(sq_ring + params.sq_off.ring_mask);
+            sq_array = (unsigned*)(sq_ring + params.sq_off.array);
+            cq_head = (unsigned*)(cq_ring + params.cq_off.head);
+            cq_tail = (unsigned*)(cq_ring + params.cq_off.tail);
+            cq_mask = *(unsigned*)(cq_ring + params.cq_off.ring_mask);
+            cqes = (io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+
+            event_fd = eventfd(0, EFD_CLOEXEC);
+            if (event_fd < 0) {
+                unmap();
+                ::close(ring_fd);
+                throw runtime_error("could not create eventfd");
+            }
+            reactor = thread([this]() { run(); });
+        }
+
+        ~UringIO() override
+        {
+            {
+                lock_guard<mutex> lock(pending_lock);
+                stopping = true;
+            }
+            wake();
+            reactor.join();
+            unmap();
+            ::close(ring_fd);
+            ::close(event_fd);
+        }
+
+        UringIO(const UringIO&) = delete;
+        UringIO& operator=(const UringIO&) = delete;
+
+        void submit(vector<AsyncRead> reads, Completion done) override
+        {
+            if (reads.empty()) {
+                done(nullptr);
+                return;
+            }
+            auto batch = make_shared<Batch>(std::move(reads), std::move(done));
+            bool failed;
+            {
+                lock_guard<mutex> lock(pending_lock);
+                failed = broken;
+                for (size_t i = 0; i < batch->reads.size() && !failed; ++i) {
+                    const auto& r = batch->reads[i];
+                    pending.push_back({ batch, i, r.offset, r.dst, r.size });
+                }
+            }
+            if (failed)
+                batch->done(make_exception_ptr(runtime_error("io_uring_enter failed")));
+            else
+                wake();
+        }
+
+    private:
+        // A read in flight, its offset, destination and size are advanced after a short read
+        struct Job { shared_ptr<Batch> batch; size_t index; ulong offset; byte* dst; size_t size; };
+
+        int ring_fd = -1;
+        int event_fd = -1;
+        unsigned sq_entries = 0, cq_entries = 0;
+        size_t sq_ring_size = 0, cq_ring_size = 0, sqes_size = 0;
+        bool single_mmap = false;
+        byte* sq_ring = nullptr;
+        byte* cq_ring = nullptr;
+        io_uring_sqe* sqes = nullptr;
+        unsigned* sq_head = nullptr;
+        unsigned* sq_tail = nullptr;
+        unsigned* sq_array = nullptr;
+        unsigned sq_mask = 0;
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned cq_mask = 0;
+        io_uring_cqe* cqes = nullptr;
+
+        thread reactor;
+        mutex pending_lock;
+        deque<Job> pending;
+        bool stopping = false;
+        bool broken = false;
+        ulong event_value = 0;
+
+        byte* map(size_t size, ulong offset) {
+            auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, (off_t)offset);
+            return p == MAP_FAILED ? nullptr : (byte*)p;
+        }
+
+        void unmap() {
+            if (sqes != nullptr)
+                munmap(sqes, sqes_size);
+            if (cq_ring != nullptr && !single_mmap)
+                munmap(cq_ring, cq_ring_size);
+            if (sq_ring != nullptr)
+                munmap(sq_ring, sq_ring_size);
+            sqes = nullptr;
+            sq_ring = cq_ring = nullptr;
+        }
+
+        void wake() {
+            ulong one = 1;
+            while (::write(event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+        }
+
+        // Adds a read to the submission queue, the user data identifies the job, or the eventfd read when it is 0
+        void push_read(int fd, byte* dst, size_t size, ulong offset, ulong user_data) {
+            auto tail = *sq_tail;
+            auto index = tail & sq_mask;
+            auto& sqe = sqes[index];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.addr = (ulong)(uintptr_t)dst;
+            sqe.len = (unsigned)min(size, (size_t)1 << 30);
+            sqe.off = offset;
+            sqe.user_data = user_data;
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        }
+
+        void run() {
+            // Jobs waiting for room in the ring, and the reads in flight, not counting the eventfd read
+            deque<Job*> ready;
+            unordered_set<Job*> in_flight;
+            bool stop = false;
+            unsigned to_submit = 0;
+            push_read(event_fd, (byte*)&event_value, sizeof(event_value), 0, 0);
+            ++to_submit;
+
+            for (;;) {
+                {
+                    lock_guard<mutex> lock(pending_lock);
+                    for (auto& job : pending)
+                        ready.push_back(new Job(std::move(job)));
+                    pending.clear();
+                    stop = stopping;
+                }
+                if (stop && ready.empty() && in_flight.empty())
+                    return;
+
+                // One slot is kept for the eventfd read
+                while (!ready.empty() && in_flight.size() + 1 < min(sq_entries, cq_entries)) {
+                    auto job = ready.front();
+                    ready.pop_front();
+                    if (job->size == 0) {
+                        complete(job, nullptr);
+                        continue;
+                    }
+                    auto fd = job->batch->reads[job->index].file->fd;
+                    push_read(fd, job->dst, job->size, job->offset, (ulong)(uintptr_t)job);
+                    in_flight.insert(job);
+                    ++to_submit;
+                }
+
+                auto r = syscall(__NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    fail_ring(ready, in_flight);
+                    return;
+                }
+                if (r > 0)
+                    to_submit -= (unsigned)min((long)to_submit, (long)r);
+
+                auto head = *cq_head;
+                while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                    auto cqe = cqes[head & cq_mask];
+                    ++head;
+                    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                    if (cqe.user_data == 0) {
+                        push_read(event_fd, (byte*)&event_value, sizeof(event_value), 0, 0);
+                        ++to_submit;
+                        continue;
+                    }
+                    auto job = (Job*)(uintptr_t)cqe.user_data;
+                    in_flight.erase(job);
+                    // A direct read of the last block of a file is short, and ends at the end of the file
+                    auto file = job->batch->reads[job->index].file;
+                    auto at_end = file->is_direct() && job->offset + (ulong)max(cqe.res, 0) >= file->size();
+                    if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                        ready.push_front(job);
+                    }
+                    else if (cqe.res < 0 || (cqe.res == 0 && !at_end)) {
+                        complete(job, make_exception_ptr(runtime_error(cqe.res == 0 ? "unexpected end of file" : "failed to read from file")));
+                    }
+                    else if ((size_t)cqe.res < job->size && !at_end) {
+                        job->offset += cqe.res;
+                        job->dst += cqe.res;
+                        job->size -= cqe.res;
+                        ready.push_front(job);
+                    }
+                    else {
+                        complete(job, nullptr);
+                    }
+                }
+            }
+        }
+
+        static void complete(Job* job, exception_ptr error) {
+            auto batch = std::move(job->batch);
+            delete job;
+            batch->finish(error);
+        }
+
+        // Fails every read, waiting or in flight, when the ring can't be entered anymore, and stops the reactor.
+        // Later submissions fail right away.
+        void fail_ring(deque<Job*>& ready, unordered_set<Job*>& in_flight) {
+            {
+                lock_guard<mutex> lock(pending_lock);
+                broken = true;
+                for (auto& job : pending)
+                    ready.push_back(new Job(std::move(job)));
+                pending.clear();
+            }
+            auto error = make_exception_ptr(runtime_error("io_uring_enter failed"));
+            for (auto job : ready)
+                complete(job, error);
+            for (auto job : in_flight)
+                complete(job, error);
+            ready.clear();
+            in_flight.clear();
+        }
+    };
+#endif
+
+    // Creates the best engine available: an io_uring if it is enabled and supported, otherwise a thread pool
+    inline unique_ptr<AsyncIO> make_async_io(unsigned queue_depth = 256)
+    {
+#ifdef BFAST_IO_URING
+        try {
+            return unique_ptr<AsyncIO>(new UringIO(queue_depth));
+        }
+        catch (const runtime_error&) {
+        }
+#endif
+        return unique_ptr<AsyncIO>(new ThreadPoolIO(min(queue_depth, max(1u, thread::hardware_concurrency()) * 4)));
+    }
+
+    // The block-aligned range of a file that a direct read of a buffer covers, and where the buffer lands in the memory read into
+    struct DirectSpan {
+        ulong file_offset;      // The offset of the read, aligned down to direct_io_alignment
+        size_t size;            // The size of the read, rounded up to direct_io_alignment
+        size_t data_offset;     // The offset of the buffer from the start of the memory read into, a multiple of 64 as buffers are aligned
+        size_t data_size;       // The size of the buffer
+    };
+
+    // A BFAST file opened for asynchronous reading: its header, array offsets and names have been read, and buffers are read on request.
+    // The engine that opened it must outlive it.
+    struct AsyncBfast : enable_shared_from_this<AsyncBfast>
+    {
+        static const size_t npos = NameIndex::npos;
+
+        AsyncIO* io = nullptr;
+        shared_ptr<FileSource> file;
+        Header header = {};
+        vector<ArrayOffset> offsets;
+
+        // The number of named buffers, not counting the names buffer
+        size_t num_buffers() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+        // Returns the name of the buffer at the given index
+        string_view name(size_t i) const { return index.name(i); }
+
+        // Returns the index of the first buffer with the given name, or npos if there is none
+        size_t find(string_view name) const { return index.find(name); }
+
+        // Returns the size in bytes of the named buffer at the given index
+        size_t buffer_size(size_t i) const {
+            const auto& offset = buffer_offset(i);
+            return (size_t)(offset._end - offset._begin);
+        }
+
+        // Reads the named buffer at the given index into dst, which must have room for buffer_size(i) bytes and stay valid until the future is ready
+        future<void> async_read_buffer(size_t i, byte* dst) {
+            const auto& offset = buffer_offset(i);
+            auto done = make_shared<promise<void>>();
+            auto r = done->get_future();
+            auto self = shared_from_this();
+            io->submit({ { file.get(), offset._begin, dst, buffer_size(i) } }, [self, done](exception_ptr error) {
+                if (error)
+                    done->set_exception(error);
+                else
+                    done->set_value();
+            });
+            return r;
+        }
+
+        // Reads the named buffer at the given index into a new aligned buffer
+        future<AlignedBuffer> async_read_buffer(size_t i) {
+            const auto& offset = buffer_offset(i);
+            auto buffer = make_shared<AlignedBuffer>(buffer_size(i));
+            auto done = make_shared<promise<AlignedBuffer>>();
+            auto r = done->get_future();
+            auto self = shared_from_this();
+            io->submit({ { file.get(), offset._begin, buffer->data(), buffer->size() } }, [self, done, buffer](exception_ptr error) {
+                if (error)
+                    done->set_exception(error);
+                else
+                    done->set_value(std::move(*buffer));
+            });
+            return r;
+        }
+
+        // Reads the named buffers with the given indices into new aligned buffers, as a single batch
+        future<vector<AlignedBuffer>> async_read_buffers(const vector<size_t>& indices) {
+            auto buffers = make_shared<vector<AlignedBuffer>>();
+            vector<AsyncRead> reads;
+            for (auto i : indices) {
+                buffers->emplace_back(buffer_size(i));
+                reads.push_back({ file.get(), buffer_offset(i)._begin, buffers->back().data(), buffers->back().size() });
+            }
+            auto done = make_shared<promise<vector<AlignedBuffer>>>();
+            auto r = done->get_future();
+            auto self = shared_from_this();
+            io->submit(std::move(reads), [self, done, buffers](exception_ptr error) {
+                if (error)
+                    done->set_exception(error);
+                else
+                    done->set_value(std::move(*buffers));
+            });
+            return r;
+        }
+
+        // Returns the range that a direct read of the named buffer at the given index covers
+        DirectSpan direct_span(size_t i) const {
+            const auto& offset = buffer_offset(i);
+            DirectSpan r;
+            r.file_offset = offset._begin / direct_io_alignment * direct_io_alignment;
+            r.data_offset = (size_t)(offset._begin - r.file_offset);
+            r.data_size = buffer_size(i);
+            r.size = (r.data_offset + r.data_size + direct_io_alignment - 1) / direct_io_alignment * direct_io_alignment;
+            return r;
+        }
+
+        // Reads the named buffers with the given indices as a single batch, bypassing the page cache, each into the memory given for it,
+        // such as pinned or mapped staging memory of a GPU. Each destination must be aligned to direct_io_alignment, have room for
+        // direct_span(i).size bytes and stay valid until the future is ready, and receives the buffer at direct_span(i).data_offset.
+        // Since the sizes of the spans are multiples of the alignment, successive spans can share one allocation.
+        // If the file system doesn't support direct I/O, the same reads go through the page cache, and stop at the end of the file.
+        future<void> async_read_direct(const vector<size_t>& indices, const vector<byte*>& dsts) {
+            if (indices.size() != dsts.size())
+                throw runtime_error("expected a destination per buffer");
+            auto direct = direct_source();
+            vector<AsyncRead> reads;
+            for (size_t j = 0; j < indices.size(); ++j) {
+                if ((uintptr_t)dsts[j] % direct_io_alignment != 0)
+                    throw runtime_error("the memory of a direct read must be aligned to " + std::to_string(direct_io_alignment) + " bytes");
+                auto span = direct_span(indices[j]);
+                // A direct read may run past the end of the file up to the alignment, a normal read stops at the end
+                auto size = direct->is_direct() ? span.size : (size_t)min((ulong)span.size, direct->size() - min(direct->size(), span.file_offset));
+                reads.push_back({ direct.get(), span.file_offset, dsts[j], size });
+            }
+            auto done = make_shared<promise<void>>();
+            auto r = done->get_future();
+            auto self = shared_from_this();
+            io->submit(std::move(reads), [self, direct, done](exception_ptr error) {
+                if (error)
+                    done->set_exception(error);
+                else
+                    done->set_value();
+            });
+            return r;
+        }
+
+    private:
+        vector<byte> names_data;
+        NameIndex index;
+        string path;
+        mutex direct_lock;
+        shared_ptr<FileSource> direct_file;
+
+        // The file opened for direct reads, on first use
+        shared_ptr<FileSource> direct_source() {
+            lock_guard<mutex> lock(direct_lock);
+            if (!direct_file)
+                direct_file = make_shared<FileSource>(path, true);
+            return direct_file;
+        }
+
+        const ArrayOffset& buffer_offset(size_t i) const {
+            if (i >= num_buffers())
+                throw out_of_range("buffer index out of range");
+            return offsets[i + 1];
+        }
+
+        friend future<shared_ptr<AsyncBfast>> async_open(AsyncIO& io, const string& path);
+    };
+
+    // Opens a BFAST file for asynchronous reading. The header and the beginning of the file are read first,
+    // and the rest of the array offsets and the names are read afterwards only if they didn't fit in it.
+    inline future<shared_ptr<AsyncBfast>> async_open(AsyncIO& io, const string& path)
+    {
+        const size_t prefix_size = 4096;
+        struct State {
+            shared_ptr<AsyncBfast> bfast;
+            promise<shared_ptr<AsyncBfast>> done;
+            vector<byte> prefix;
+        };
+        auto state = make_shared<State>();
+        auto r = state->done.get_future();
+        try {
+            auto bfast = make_shared<AsyncBfast>();
+            bfast->io = &io;
+            bfast->file = make_shared<FileSource>(path);
+            bfast->path = path;
+            state->bfast = bfast;
+            state->prefix.resize((size_t)min((ulong)prefix_size, bfast->file->size()));
+        }
+        catch (...) {
+            state->done.set_exception(current_exception());
+            return r;
+        }
+
+        // Each step runs on an I/O thread when the reads of the previous one have completed
+        auto fail = [state](exception_ptr error) { state->done.set_exception(error); };
+        auto finish = [state, fail](exception_ptr error) {
+            if (error)
+                return fail(error);
+            try {
+                auto& b = *state->bfast;
+                b.index = NameIndex((const char*)b.names_data.data(), b.names_data.size(), b.num_buffers());
+                state->done.set_value(state->bfast);
+            }
+            catch (...) {
+                fail(current_exception());
+            }
+        };
+        auto read_names = [state, fail, finish](exception_ptr error) {
+            if (error)
+                return fail(error);
+            try {
+                auto& b = *state->bfast;
+                check_offsets(b.header, b.offsets.data());
+                if (b.offsets.empty())
+                    return finish(nullptr);
+                const auto& names = b.offsets[0];
+                b.names_data.resize((size_t)(names._end - names._begin));
+                if (names._end <= state->prefix.size()) {
+                    memcpy(b.names_data.data(), state->prefix.data() + names._begin, b.names_data.size());
+                    return finish(nullptr);
+                }
+                b.io->submit({ { b.file.get(), names._begin, b.names_data.data(), b.names_data.size() } }, finish);
+            }
+            catch (...) {
+                fail(current_exception());
+            }
+        };
+        auto read_offsets = [state, fail, read_names](exception_ptr error) {
+            if (error)
+                return fail(error);
+            try {
+                auto& b = *state->bfast;
+                if (state->prefix.size() < header_size)
+                    throw runtime_error("not enough data for a BFast header");
+                memcpy(&b.header, state->prefix.data(), sizeof(Header));
+                check_header(b.header, (size_t)b.file->size());
+                b.offsets.resize((size_t)b.header.num_arrays);
+                auto begin = (size_t)array_offsets_start;
+                auto end = begin + b.offsets.size() * sizeof(ArrayOffset);
+                auto available = min(end, max(begin, state->prefix.size()));
+                memcpy(b.offsets.data(), state->prefix.data() + begin, available - begin);
+                if (available == end)
+                    return read_names(nullptr);
+                b.io->submit({ { b.file.get(), available, (byte*)b.offsets.data() + (available - begin), end - available } }, read_names);
+            }
+            catch (...) {
+                fail(current_exception());
+            }
+        };
+        io.submit({ { state->bfast->file.get(), 0, state->prefix.data(), state->prefix.size() } }, read_offsets);
+        return r;
+    }
+}
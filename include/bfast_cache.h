@@ -0,0 +1,475 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    A cache of BFAST containers in POSIX shared memory, shared by all the processes of a machine that open it with the same name.
+    Each container is stored, validated once, in its own shared memory object, and an index in another shared memory object
+    maps keys to containers. A process that finds a container in the cache maps it and gets a BfastView over it, with no disk read
+    and no validation or deserialization: the header and array offsets are used in place, as with a mapped file.
+
+        bfast::SharedCache cache("render-assets");
+        auto view = cache.open(path);
+
+    Files are keyed by path, modification time and size, and other containers by any string, such as a hash of their content.
+    When the total size of the containers exceeds the capacity of the cache, the least recently used ones are evicted.
+    An evicted container stays valid in the processes that have it mapped, until they release their views.
+*/
+#pragma once
+
+#include "bfast.h"
+
+#ifdef _WIN32
+#error "bfast_cache.h requires POSIX shared memory"
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+#include <chrono>
+
+namespace bfast
+{
+    // Options for creating a shared cache, which are ignored if another process has already created it
+    struct SharedCacheOptions {
+        // The most bytes of containers kept in the cache
+        ulong capacity = (ulong)1 << 30;
+        // The most containers kept in the cache
+        size_t max_entries = 1024;
+    };
+
+    // A cache of validated BFAST containers kept in shared memory, with least recently used eviction by total size.
+    // All operations lock the index of the cache, which is shared with the other processes, and scan all of its entries,
+    // comparing the keys of the same length: about a microsecond with the default 1024 entries.
+    // Reading files and copying containers is done outside of the lock.
+    struct SharedCache
+    {
+        // The longest key accepted
+        static const size_t max_key_size = 512;
+
+        // Opens the cache with the given name, creating it if no other process has
+        explicit SharedCache(const string& name, const SharedCacheOptions& options = SharedCacheOptions())
+            : name(name)
+        {
+            if (name.empty() || name.find('/') != string::npos)
+                throw runtime_error("a cache name must be non-empty and have no slashes");
+            open_index(options);
+            Lock lock(index);
+            remove_abandoned_entries();
+        }
+
+        ~SharedCache() { munmap(index, index_size); }
+
+        SharedCache(const SharedCache&) = delete;
+        SharedCache& operator=(const SharedCache&) = delete;
+
+        // Returns a view of the BFAST file at the given path, from the cache if it has the same modification time and size,
+        // otherwise the file is read into the cache, replacing the previous versions of it.
+        BfastView open(const string& path) {
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+                throw runtime_error("could not get size of file " + path);
+            auto mtime = (ulong)st.st_mtim.tv_sec * 1000000000 + (ulong)st.st_mtim.tv_nsec;
+            auto key = path + '\n' + std::to_string(mtime) + '\n' + std::to_string((ulong)st.st_size);
+            auto r = find(key);
+            if (r.data != nullptr)
+                return r;
+            FileSource file(path);
+            return publish(key, (size_t)file.size(), path + '\n', [&](byte* dst, size_t size) { file.read(0, dst, size); });
+        }
+
+        // Returns a view of the container with the given key, or an empty view if it isn't in the cache
+        BfastView find(const string& key) {
+            int fd = -1;
+            size_t size = 0;
+            {
+                Lock lock(index);
+                auto e = lookup(key);
+                if (e == nullptr) {
+                    ++index->misses;
+                    return BfastView();
+                }
+                ++index->hits;
+                e->last_used = ++index->clock;
+                size = (size_t)e->size;
+                // The object can't be unlinked by another process while the index is locked
+                fd = shm_open(segment_name(e->id).c_str(), O_RDONLY, 0);
+                if (fd < 0)
+                    return BfastView();
+            }
+            return map_segment(fd, size);
+        }
+
+        // Copies a container into the cache under the given key, replacing any previous one, and returns a view of the cached copy.
+        // The container is validated first, and an exception is thrown if it is not a valid BFAST.
+        // A container larger than the capacity of the cache is not kept, but a view of it is returned anyway.
+        BfastView insert(const string& key, const byte* data, size_t size) {
+            return publish(key, size, string_view(), [&](byte* dst, size_t n) { memcpy(dst, data, n); });
+        }
+
+        // Removes the container with the given key, returns false if there is none
+        bool erase(const string& key) {
+            Lock lock(index);
+            auto e = lookup(key);
+            if (e == nullptr)
+                return false;
+            release(*e);
+            return true;
+        }
+
+        // Removes all the containers
+        void clear() {
+            Lock lock(index);
+            for (size_t i = 0; i < index->max_entries; ++i)
+                if (entries()[i].id != 0)
+                    release(entries()[i]);
+        }
+
+        // The number of containers in the cache
+        size_t size() const {
+            Lock lock(index);
+            size_t r = 0;
+            for (size_t i = 0; i < index->max_entries; ++i)
+                r += entries()[i].id != 0 && entries()[i].validated != 0;
+            return r;
+        }
+
+        // The total size of the containers in the cache
+        ulong used() const { Lock lock(index); return index->used; }
+
+        // The most bytes of containers kept in the cache
+        ulong capacity() const { return index->capacity; }
+
+        // The number of lookups that found a container, and that didn't, and the number of containers evicted, over all processes
+        ulong hits() const { Lock lock(index); return index->hits; }
+        ulong misses() const { Lock lock(index); return index->misses; }
+        ulong evictions() const { Lock lock(index); return index->evictions; }
+
+        // Removes the cache with the given name and all of its containers from the system.
+        // Processes that have it open keep their mappings, but should not use the cache anymore.
+        static void destroy(const string& name) {
+            {
+                SharedCache cache(name);
+                cache.clear();
+            }
+            shm_unlink(index_name(name).c_str());
+        }
+
+    private:
+        // An entry is pending from the time its shared memory object is created until the container is validated and indexed,
+        // so that the object can be removed if the process publishing it dies in between
+        struct Entry {
+            ulong id;           // Zero if the entry is free
+            ulong validated;    // Nonzero once the container was validated, so that views of it are created without validating it again
+            ulong owner;        // The pid of the process publishing the container while the entry is pending
+            ulong size;
+            ulong last_used;
+            ulong key_size;
+            char key[max_key_size];
+        };
+
+        // The shared state, followed by max_entries entries
+        struct Index {
+            atomic<ulong> ready;
+            atomic<ulong> creator;  // The pid of the process initializing the index
+            ulong capacity;
+            ulong max_entries;
+            ulong used;
+            ulong clock;
+            ulong next_id;
+            ulong hits;
+            ulong misses;
+            ulong evictions;
+            pthread_mutex_t mutex;
+        };
+
+        static constexpr size_t entries_offset = aligned_value(sizeof(Index));
+
+        // Locks the index. If the process holding it died, the total size is recomputed, since it may have been halfway through an update.
+        struct Lock {
+            Index* index;
+            explicit Lock(Index* index) : index(index) {
+                auto r = pthread_mutex_lock(&index->mutex);
+                if (r == EOWNERDEAD) {
+                    auto e = (Entry*)((byte*)index + entries_offset);
+                    index->used = 0;
+                    for (size_t i = 0; i < index->max_entries; ++i)
+                        index->used += e[i].id != 0 && e[i].validated != 0 ? e[i].size : 0;
+                    pthread_mutex_consistent(&index->mutex);
+                }
+                else if (r != 0) {
+                    throw runtime_error("could not lock the cache index");
+                }
+            }
+            ~Lock() { pthread_mutex_unlock(&index->mutex); }
+        };
+
+        string name;
+        Index* index = nullptr;
+        size_t index_size = 0;
+
+        static string index_name(const string& name) { return "/" + name + ".index"; }
+        string segment_name(ulong id) const { return "/" + name + "." + std::to_string(id); }
+
+        Entry* entries() const { return (Entry*)((byte*)index + entries_offset); }
+
+        // Maps the index, creating and initializing it if it doesn't exist, or waiting for the process creating it to be done.
+        // An index that its creator never finished initializing, because it died or took too long, is removed and created again.
+        void open_index(const SharedCacheOptions& options) {
+            auto path = index_name(name);
+            for (int attempt = 0; attempt < 3; ++attempt) {
+                int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+                if (fd >= 0) {
+                    create_index(fd, path, options);
+                    return;
+                }
+                if (errno != EEXIST)
+                    throw runtime_error("could not open the cache index " + path);
+                fd = shm_open(path.c_str(), O_RDWR, 0);
+                if (fd < 0) {
+                    // The index was removed in the meantime
+                    if (errno == ENOENT)
+                        continue;
+                    throw runtime_error("could not open the cache index " + path);
+                }
+                if (wait_for_index(fd)) {
+                    ::close(fd);
+                    if (index_size < entries_offset + index->max_entries * sizeof(Entry))
+                        throw runtime_error("the cache index " + path + " is too small");
+                    return;
+                }
+                remove_abandoned_index(fd, path);
+            }
+            throw runtime_error("the cache index " + path + " was not initialized");
+        }
+
+        void create_index(int fd, const string& path, const SharedCacheOptions& options) {
+            index_size = entries_offset + options.max_entries * sizeof(Entry);
+            if (ftruncate(fd, (off_t)index_size) != 0) {
+                ::close(fd);
+                shm_unlink(path.c_str());
+                throw runtime_error("could not allocate the cache index");
+            }
+            index = (Index*)map_shared(fd, index_size);
+            ::close(fd);
+            index->creator.store((ulong)getpid(), memory_order_release);
+            index->capacity = options.capacity;
+            index->max_entries = options.max_entries;
+            index->next_id = 1;
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&index->mutex, &attr);
+            pthread_mutexattr_destroy(&attr);
+            index->ready.store(1, memory_order_release);
+        }
+
+        // Maps the index and waits until it is ready. Returns false if its creator died before it was ready, or didn't make it ready
+        // within 10 seconds, in which case it is unmapped.
+        bool wait_for_index(int fd) {
+            // The creator sets the size of the index, then its pid, before initializing it
+            auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+            for (;;) {
+                struct stat st;
+                if (fstat(fd, &st) == 0 && (size_t)st.st_size >= entries_offset) {
+                    if (index == nullptr) {
+                        index_size = (size_t)st.st_size;
+                        index = (Index*)map_shared(fd, index_size);
+                    }
+                    if (index->ready.load(memory_order_acquire) != 0)
+                        return true;
+                    auto creator = (pid_t)index->creator.load(memory_order_acquire);
+                    if (creator != 0 && kill(creator, 0) != 0 && errno == ESRCH)
+                        break;
+                }
+                if (chrono::steady_clock::now() > deadline)
+                    break;
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+            if (index != nullptr)
+                munmap(index, index_size);
+            index = nullptr;
+            index_size = 0;
+            return false;
+        }
+
+        // Removes an index that was never made ready, unless another process has already replaced it
+        static void remove_abandoned_index(int fd, const string& path) {
+            struct stat abandoned, current;
+            auto same = false;
+            int current_fd = shm_open(path.c_str(), O_RDONLY, 0);
+            if (current_fd >= 0) {
+                same = fstat(fd, &abandoned) == 0 && fstat(current_fd, &current) == 0
+                    && abandoned.st_dev == current.st_dev && abandoned.st_ino == current.st_ino;
+                ::close(current_fd);
+            }
+            ::close(fd);
+            if (same)
+                shm_unlink(path.c_str());
+        }
+
+        static byte* map_shared(int fd, size_t size) {
+            auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw runtime_error("could not map shared memory");
+            }
+            return (byte*)p;
+        }
+
+        // Creates a view of a container in a shared memory object, sharing its pages with the other processes.
+        // The container was validated by the process that published it, and is not validated again.
+        static BfastView map_segment(int fd, size_t size) {
+            shared_ptr<MappedFile> mapping;
+            try {
+                mapping = make_shared<MappedFile>(fd, size);
+            }
+            catch (...) {
+                ::close(fd);
+                throw;
+            }
+            ::close(fd);
+            return BfastView::from_validated(mapping->data, mapping->size, mapping);
+        }
+
+        // Returns the indexed entry with the given key, scanning all the entries, with the index locked
+        Entry* lookup(string_view key) const {
+            for (size_t i = 0; i < index->max_entries; ++i) {
+                auto& e = entries()[i];
+                if (e.id != 0 && e.validated != 0 && string_view(e.key, (size_t)e.key_size) == key)
+                    return &e;
+            }
+            return nullptr;
+        }
+
+        Entry* entry_with_id(ulong id) const {
+            for (size_t i = 0; i < index->max_entries; ++i)
+                if (entries()[i].id == id)
+                    return &entries()[i];
+            return nullptr;
+        }
+
+        // Removes an entry and its shared memory object, with the index locked
+        void release(Entry& e) {
+            shm_unlink(segment_name(e.id).c_str());
+            if (e.validated != 0)
+                index->used -= e.size;
+            e.id = 0;
+            e.validated = 0;
+        }
+
+        // Removes the pending entries of the processes that died while publishing them, with the index locked
+        void remove_abandoned_entries() {
+            for (size_t i = 0; i < index->max_entries; ++i) {
+                auto& e = entries()[i];
+                if (e.id != 0 && e.validated == 0 && kill((pid_t)e.owner, 0) != 0 && errno == ESRCH)
+                    release(e);
+            }
+        }
+
+        // Creates a shared memory object of the given size, fills it, validates it, and adds it to the index under the given key.
+        // The entries whose key starts with the given prefix are replaced.
+        template<typename Fill>
+        BfastView publish(const string& key, size_t size, string_view replaces, Fill fill) {
+            if (key.size() > max_key_size)
+                throw runtime_error("the cache key is too long");
+            if (size < header_size)
+                throw runtime_error(error_message(error_too_small));
+            ulong id;
+            {
+                Lock lock(index);
+                remove_abandoned_entries();
+                while (free_entry() == nullptr)
+                    if (!evict_oldest())
+                        throw runtime_error("every entry of the cache is being published");
+                auto& e = *free_entry();
+                id = e.id = index->next_id++;
+                e.validated = 0;
+                e.owner = (ulong)getpid();
+                e.size = size;
+                e.key_size = 0;
+            }
+            auto segment = segment_name(id);
+            int fd = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            void* p = MAP_FAILED;
+            try {
+                if (fd < 0)
+                    throw runtime_error("could not create shared memory object " + segment);
+                if (ftruncate(fd, (off_t)size) != 0)
+                    throw runtime_error("could not allocate shared memory object " + segment);
+                p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                    throw runtime_error("could not map shared memory object " + segment);
+                fill((byte*)p, size);
+                auto result = validate((const byte*)p, size, false);
+                if (!result)
+                    throw runtime_error(result.message());
+                munmap(p, size);
+            }
+            catch (...) {
+                if (p != MAP_FAILED)
+                    munmap(p, size);
+                if (fd >= 0)
+                    ::close(fd);
+                Lock lock(index);
+                if (auto e = entry_with_id(id))
+                    release(*e);
+                throw;
+            }
+            {
+                Lock lock(index);
+                // The pending entry is gone if the cache was cleared in the meantime
+                auto pending = entry_with_id(id);
+                bool kept = pending != nullptr && size <= index->capacity;
+                if (kept) {
+                    for (size_t i = 0; i < index->max_entries; ++i) {
+                        auto& e = entries()[i];
+                        if (e.id == 0 || e.validated == 0)
+                            continue;
+                        auto k = string_view(e.key, (size_t)e.key_size);
+                        if (k == key || (!replaces.empty() && k.substr(0, replaces.size()) == replaces))
+                            release(e);
+                    }
+                    while (index->used + size > index->capacity)
+                        evict_oldest();
+                    pending->validated = 1;
+                    pending->last_used = ++index->clock;
+                    pending->key_size = key.size();
+                    memcpy(pending->key, key.data(), key.size());
+                    index->used += size;
+                }
+                else if (pending != nullptr) {
+                    release(*pending);
+                }
+                else {
+                    shm_unlink(segment.c_str());
+                }
+            }
+            return map_segment(fd, size);
+        }
+
+        // Evicts the least recently used container, with the index locked. Returns false if there is none.
+        bool evict_oldest() {
+            Entry* oldest = nullptr;
+            for (size_t i = 0; i < index->max_entries; ++i) {
+                auto& e = entries()[i];
+                if (e.id != 0 && e.validated != 0 && (oldest == nullptr || e.last_used < oldest->last_used))
+                    oldest = &e;
+            }
+            if (oldest == nullptr)
+                return false;
+            release(*oldest);
+            ++index->evictions;
+            return true;
+        }
+
+        Entry* free_entry() const {
+            for (size_t i = 0; i < index->max_entries; ++i)
+                if (entries()[i].id == 0)
+                    return &entries()[i];
+            return nullptr;
+        }
+    };
+}
@@ -0,0 +1,461 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Optional per-buffer compression. This is an extension of the format: each buffer may be stored compressed, and a reserved buffer
+    named "bfast:compression" holds one CompressionEntry per preceding buffer with its codec and uncompressed size. It is the last
+    buffer, or the one before the checksum table when the file has one (see BfastData::pack_with_checksums), which then covers the
+    compression table too. The container itself is a regular BFAST, so readers that don't know the extension can still read every buffer,
+    in its stored form, and random access to individual buffers is preserved.
+
+    Large buffers can also be split into independently compressed frames of a fixed power of two size, so that a slice of a buffer can be
+    read by decompressing only the frames that overlap it. A framed buffer starts with a frame index: the number of frames as a 64-bit
+    integer, followed by one more 64-bit offset than there are frames, relative to the end of the index, where each frame begins and the
+    last one ends. A frame whose stored size equals its uncompressed size is stored uncompressed.
+
+    Codecs are enabled by defining BFAST_WITH_LZ4 and/or BFAST_WITH_ZSTD, and linking against the corresponding library.
+*/
+#pragma once
+
+#include "bfast.h"
+
+#ifdef BFAST_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef BFAST_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace bfast
+{
+    // Identifies how a buffer is stored
+    enum Codec : uint32_t {
+        codec_none = 0,
+        codec_lz4 = 1,
+        codec_zstd = 2,
+    };
+
+    // An entry of the compression table, describing how the buffer with the same index is stored
+    struct CompressionEntry {
+        uint32_t codec;
+        uint32_t frame_size_log2;   // 0 if the buffer is compressed as a whole, otherwise the base 2 logarithm of the frame size
+        ulong uncompressed_size;
+    };
+
+    // The largest ratio of the uncompressed size of a buffer to its stored size that each codec can reach, which bounds the
+    // uncompressed sizes read from the compression table. An LZ4 byte expands to at most 255 bytes, and a Zstd block of up to
+    // 128 KB takes at least 4 bytes.
+    const ulong lz4_max_ratio = 255;
+    const ulong zstd_max_ratio = 32768;
+
+    // Returns true if the codec is available in this build
+    inline bool codec_available(Codec codec)
+    {
+        switch (codec) {
+        case codec_none: return true;
+#ifdef BFAST_WITH_LZ4
+        case codec_lz4: return true;
+#endif
+#ifdef BFAST_WITH_ZSTD
+        case codec_zstd: return true;
+#endif
+        default: return false;
+        }
+    }
+
+    // Returns the maximum compressed size of size bytes
+    inline size_t compress_bound(Codec codec, size_t size)
+    {
+        switch (codec) {
+        case codec_none: return size;
+#ifdef BFAST_WITH_LZ4
+        case codec_lz4:
+            if (size > LZ4_MAX_INPUT_SIZE)
+                throw runtime_error("buffer is too large to be compressed with LZ4");
+            return (size_t)LZ4_compressBound((int)size);
+#endif
+#ifdef BFAST_WITH_ZSTD
+        case codec_zstd: return ZSTD_compressBound(size);
+#endif
+        default: throw runtime_error("compression codec is not available");
+        }
+    }
+
+    // Compresses size bytes from src into dst, which must have room for compress_bound() bytes, and returns the compressed size.
+    // For Zstd the level is the compression level, for LZ4 it is the acceleration factor (1 is the default).
+    inline size_t compress(Codec codec, int level, const byte* src, size_t size, byte* dst, size_t capacity)
+    {
+        (void)level;
+        switch (codec) {
+        case codec_none:
+            if (capacity < size)
+                throw runtime_error("destination is too small");
+            if (size > 0)
+                memcpy(dst, src, size);
+            return size;
+#ifdef BFAST_WITH_LZ4
+        case codec_lz4: {
+            if (size > LZ4_MAX_INPUT_SIZE)
+                throw runtime_error("buffer is too large to be compressed with LZ4");
+            auto n = LZ4_compress_fast((const char*)src, (char*)dst, (int)size, (int)min(capacity, (size_t)INT32_MAX), max(level, 1));
+            if (n <= 0 && size > 0)
+                throw runtime_error("LZ4 compression failed");
+            return (size_t)n;
+        }
+#endif
+#ifdef BFAST_WITH_ZSTD
+        case codec_zstd: {
+            auto n = ZSTD_compress(dst, capacity, src, size, level);
+            if (ZSTD_isError(n))
+                throw runtime_error(string("Zstd compression failed: ") + ZSTD_getErrorName(n));
+            return n;
+        }
+#endif
+        default: throw runtime_error("compression codec is not available");
+        }
+    }
+
+    // Decompresses size bytes from src into dst, which must have room for exactly uncompressed_size bytes
+    inline void decompress(Codec codec, const byte* src, size_t size, byte* dst, size_t uncompressed_size)
+    {
+        switch (codec) {
+        case codec_none:
+            if (size != uncompressed_size)
+                throw runtime_error("stored buffer size does not match its uncompressed size");
+            if (size > 0)
+                memcpy(dst, src, size);
+            return;
+#ifdef BFAST_WITH_LZ4
+        case codec_lz4: {
+            if (size > INT32_MAX || uncompressed_size > INT32_MAX)
+                throw runtime_error("buffer is too large to be decompressed with LZ4");
+            auto n = LZ4_decompress_safe((const char*)src, (char*)dst, (int)size, (int)uncompressed_size);
+            if (n < 0 || (size_t)n != uncompressed_size)
+                throw runtime_error("LZ4 decompression failed");
+            return;
+        }
+#endif
+#ifdef BFAST_WITH_ZSTD
+        case codec_zstd: {
+            auto n = ZSTD_decompress(dst, uncompressed_size, src, size);
+            if (ZSTD_isError(n))
+                throw runtime_error(string("Zstd decompression failed: ") + ZSTD_getErrorName(n));
+            if (n != uncompressed_size)
+                throw runtime_error("decompressed size does not match the uncompressed size");
+            return;
+        }
+#endif
+        default: throw runtime_error("compression codec is not available");
+        }
+    }
+
+    // Options for packing a BFAST with per-buffer compression
+    struct CompressionOptions {
+        Codec codec = codec_zstd;
+        int level = 3;
+        // Buffers smaller than this are stored uncompressed
+        size_t min_size = 256;
+        // Buffers larger than this are split into separately compressed frames of this size, which must be a power of two, 0 disables frames
+        size_t frame_size = 0;
+        // Buffers are compressed in parallel with these options
+        ParallelOptions parallel;
+    };
+
+    // Returns a vector of bytes containing a BFAST where each buffer is compressed. The buffers, and the frames of large buffers,
+    // are compressed in parallel, and buffers that are too small, or that don't get smaller, are stored uncompressed.
+    inline vector<byte> pack_compressed(BfastData& data, const CompressionOptions& options = CompressionOptions())
+    {
+        uint32_t frame_size_log2 = 0;
+        if (options.frame_size > 0) {
+            while (((size_t)1 << frame_size_log2) < options.frame_size)
+                ++frame_size_log2;
+            if (((size_t)1 << frame_size_log2) != options.frame_size)
+                throw runtime_error("the frame size must be a power of two");
+        }
+
+        // Each task compresses a whole buffer, or one frame of a framed buffer
+        auto n = data.buffers.size();
+        struct Task { size_t buffer; size_t frame; };
+        vector<Task> tasks;
+        vector<vector<vector<byte>>> frames(n);
+        vector<CompressionEntry> table(n);
+        for (size_t i = 0; i < n; ++i) {
+            auto size = data.buffers[i].data.size();
+            table[i] = { codec_none, 0, size };
+            if (size < options.min_size || options.codec == codec_none)
+                continue;
+            if (frame_size_log2 > 0 && size > options.frame_size) {
+                table[i].frame_size_log2 = frame_size_log2;
+                frames[i].resize((size + options.frame_size - 1) >> frame_size_log2);
+            }
+            else {
+                frames[i].resize(1);
+            }
+            for (size_t j = 0; j < frames[i].size(); ++j)
+                tasks.push_back({ i, j });
+        }
+
+        parallel_for(tasks.size(), options.parallel.num_threads, [&](size_t t) {
+            const auto& task = tasks[t];
+            const auto& range = data.buffers[task.buffer].data;
+            auto begin = range.begin();
+            auto size = range.size();
+            if (table[task.buffer].frame_size_log2 > 0) {
+                begin += task.frame << frame_size_log2;
+                size = min(options.frame_size, (size_t)(range.end() - begin));
+            }
+            auto& out = frames[task.buffer][task.frame];
+            out.resize(compress_bound(options.codec, size));
+            out.resize(compress(options.codec, options.level, begin, size, out.data(), out.size()));
+            if (out.size() >= size)
+                out.assign(begin, begin + size);
+        });
+
+        // Assemble each compressed buffer, or fall back to storing it uncompressed if it didn't get smaller
+        vector<vector<byte>> compressed(n);
+        for (size_t i = 0; i < n; ++i) {
+            auto& out = compressed[i];
+            if (frames[i].empty())
+                continue;
+            if (table[i].frame_size_log2 == 0) {
+                out = std::move(frames[i][0]);
+            }
+            else {
+                vector<ulong> index = { (ulong)frames[i].size(), 0 };
+                for (const auto& frame : frames[i])
+                    index.push_back(index.back() + frame.size());
+                auto index_begin = (const byte*)index.data();
+                out.assign(index_begin, index_begin + index.size() * sizeof(ulong));
+                for (const auto& frame : frames[i])
+                    out.insert(out.end(), frame.begin(), frame.end());
+            }
+            frames[i] = vector<vector<byte>>();
+            if (out.size() >= table[i].uncompressed_size) {
+                out = vector<byte>();
+                table[i] = { codec_none, 0, table[i].uncompressed_size };
+            }
+            else {
+                table[i].codec = options.codec;
+            }
+        }
+
+        BfastData r;
+        r.buffers.reserve(n + 1);
+        for (size_t i = 0; i < n; ++i) {
+            auto& b = data.buffers[i];
+            if (table[i].codec == codec_none)
+                r.add(b.name, b.data.begin(), b.data.end());
+            else
+                r.add(b.name, compressed[i].data(), compressed[i].data() + compressed[i].size());
+        }
+        auto table_begin = (byte*)table.data();
+        r.add(compression_table_name, table_begin, table_begin + table.size() * sizeof(CompressionEntry));
+        return r.pack_parallel(options.parallel);
+    }
+
+    // Reads the buffers of a BFAST that may be compressed per buffer, decompressing each one on demand into caller memory.
+    // A BFAST without a compression table is read as if every buffer was stored uncompressed.
+    struct CompressedBfastReader
+    {
+        static const size_t npos = NameIndex::npos;
+
+        BfastView view;
+
+        explicit CompressedBfastReader(BfastView v)
+            : view(std::move(v))
+        {
+            auto n = view.num_buffers();
+            auto t = n > 0 && view.name(n - 1) == checksum_table_name ? n - 1 : n;
+            if (t > 0 && view.name(t - 1) == compression_table_name) {
+                auto r = view.buffer(t - 1);
+                if (r.size() != (t - 1) * sizeof(CompressionEntry))
+                    throw runtime_error("compression table size does not match the number of buffers");
+                count = t - 1;
+                table.resize(count);
+                memcpy(table.data(), r.begin(), r.size());
+                if (view.swapped()) {
+                    for (auto& e : table) {
+                        byte_swap<sizeof(uint32_t)>(&e.codec, &e.codec, 2);
+                        byte_swap<sizeof(ulong)>(&e.uncompressed_size, &e.uncompressed_size, 1);
+                    }
+                }
+                for (size_t i = 0; i < count; ++i)
+                    check_entry(i);
+            }
+            else {
+                // A compression table anywhere else would be silently ignored
+                if (view.find(compression_table_name) != npos)
+                    throw runtime_error("the compression table must be the last buffer, or the one before the checksum table");
+                count = n;
+            }
+        }
+
+        // The number of buffers, not counting the compression table and the checksum table that follows it
+        size_t num_buffers() const { return count; }
+
+        // Returns the name of the buffer at the given index
+        string_view name(size_t i) const { return view.name(i); }
+
+        // Returns the index of the first buffer with the given name, or npos if there is none
+        size_t find(string_view name) const {
+            auto i = view.find(name);
+            return i < count ? i : npos;
+        }
+
+        // Returns how the buffer at the given index is stored
+        Codec codec(size_t i) const { return table.empty() ? codec_none : (Codec)entry(i).codec; }
+
+        // Returns the size of the buffer at the given index once decompressed
+        size_t uncompressed_size(size_t i) const { return table.empty() ? stored(i).size() : (size_t)entry(i).uncompressed_size; }
+
+        // Returns the buffer at the given index as it is stored
+        ByteRange stored(size_t i) const { check_index(i); return view.buffer(i); }
+
+        // Returns the frame size of the buffer at the given index, or 0 if it isn't split into frames
+        size_t frame_size(size_t i) const {
+            auto log2 = table.empty() ? 0 : entry(i).frame_size_log2;
+            return log2 == 0 ? 0 : (size_t)1 << log2;
+        }
+
+        // Decompresses the buffer at the given index into dst, which must have room for uncompressed_size(i) bytes.
+        // The frames of a framed buffer are decompressed in parallel.
+        void decompress(size_t i, byte* dst, const ParallelOptions& options = ParallelOptions()) const {
+            decompress_range(i, 0, uncompressed_size(i), dst, options);
+        }
+
+        // Decompresses size bytes starting at the given offset of the uncompressed buffer at the given index into dst.
+        // For a framed buffer only the frames that overlap the range are decompressed, in parallel, and a buffer compressed as a whole is decompressed entirely.
+        void decompress_range(size_t i, size_t offset, size_t size, byte* dst, const ParallelOptions& options = ParallelOptions()) const {
+            auto total = uncompressed_size(i);
+            if (offset > total || size > total - offset)
+                throw out_of_range("range is outside of the buffer");
+            auto r = stored(i);
+            auto c = codec(i);
+            if (c == codec_none) {
+                if (size > 0)
+                    memcpy(dst, r.begin() + offset, size);
+                return;
+            }
+
+            auto fs = frame_size(i);
+            if (fs == 0) {
+                if (offset == 0 && size == total) {
+                    bfast::decompress(c, r.begin(), r.size(), dst, total);
+                }
+                else {
+                    vector<byte> tmp(total);
+                    bfast::decompress(c, r.begin(), r.size(), tmp.data(), total);
+                    memcpy(dst, tmp.data() + offset, size);
+                }
+                return;
+            }
+
+            if (size == 0)
+                return;
+            auto frames = num_frames(total, fs);
+            auto index_size = (frames + 2) * sizeof(ulong);
+            if (r.size() < index_size || read_ulong(r.begin()) != frames)
+                throw runtime_error("invalid frame index");
+            auto frame_data = r.begin() + index_size;
+            auto frame_data_size = r.size() - index_size;
+
+            auto first = offset / fs;
+            auto last = (offset + size - 1) / fs;
+            parallel_for(last - first + 1, options.num_threads, [&](size_t k) {
+                auto f = first + k;
+                auto begin = read_ulong(r.begin() + (f + 1) * sizeof(ulong));
+                auto end = read_ulong(r.begin() + (f + 2) * sizeof(ulong));
+                if (begin > end || end > frame_data_size)
+                    throw runtime_error("invalid frame index");
+                auto frame_begin = f * fs;
+                auto frame_size = min(fs, total - frame_begin);
+                auto frame_codec = end - begin == frame_size ? codec_none : c;
+
+                // Decompress directly into the destination if the frame is completely within the range
+                auto copy_begin = max(frame_begin, offset);
+                auto copy_end = min(frame_begin + frame_size, offset + size);
+                if (copy_begin == frame_begin && copy_end == frame_begin + frame_size) {
+                    bfast::decompress(frame_codec, frame_data + begin, end - begin, dst + (frame_begin - offset), frame_size);
+                }
+                else {
+                    vector<byte> tmp(frame_size);
+                    bfast::decompress(frame_codec, frame_data + begin, end - begin, tmp.data(), frame_size);
+                    memcpy(dst + (copy_begin - offset), tmp.data() + (copy_begin - frame_begin), copy_end - copy_begin);
+                }
+            });
+        }
+
+        // Returns a copy of the buffer at the given index, decompressed
+        vector<byte> get(size_t i) const {
+            vector<byte> r(uncompressed_size(i));
+            decompress(i, r.data());
+            return r;
+        }
+
+        // Returns a copy of size bytes starting at the given offset of the buffer at the given index, decompressed
+        vector<byte> get_range(size_t i, size_t offset, size_t size) const {
+            vector<byte> r(size);
+            decompress_range(i, offset, size, r.data());
+            return r;
+        }
+
+    private:
+        vector<CompressionEntry> table;
+        size_t count = 0;
+
+        void check_index(size_t i) const {
+            if (i >= count)
+                throw out_of_range("buffer index out of range");
+        }
+
+        const CompressionEntry& entry(size_t i) const {
+            check_index(i);
+            return table[i];
+        }
+
+        // Checks an entry of the compression table, which comes from an untrusted source, against the buffer it describes
+        void check_entry(size_t i) const {
+            const auto& e = table[i];
+            if (e.codec != codec_none && e.codec != codec_lz4 && e.codec != codec_zstd)
+                throw runtime_error("unknown compression codec");
+            auto stored_size = view.buffer(i).size();
+            if (e.codec == codec_none && e.uncompressed_size != stored_size)
+                throw runtime_error("stored buffer size does not match its uncompressed size");
+            auto max_ratio = e.codec == codec_lz4 ? lz4_max_ratio : e.codec == codec_zstd ? zstd_max_ratio : 1;
+            if (e.uncompressed_size > (ulong)SIZE_MAX || e.uncompressed_size / max_ratio > stored_size)
+                throw runtime_error("uncompressed size is too large for the stored size");
+#ifdef BFAST_WITH_ZSTD
+            // A Zstd buffer compressed as a whole records its size, unless it was compressed as a stream
+            if (e.codec == codec_zstd && e.frame_size_log2 == 0) {
+                auto content_size = ZSTD_getFrameContentSize(view.buffer(i).begin(), stored_size);
+                if (content_size == ZSTD_CONTENTSIZE_ERROR || (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != e.uncompressed_size))
+                    throw runtime_error("uncompressed size does not match the size of the Zstd frame");
+            }
+#endif
+            if (e.codec == codec_none || e.frame_size_log2 == 0)
+                return;
+            if (e.frame_size_log2 >= sizeof(size_t) * 8)
+                throw runtime_error("invalid frame size");
+            // The frame index must fit in the stored buffer, which also bounds the number of frames
+            auto frames = num_frames((size_t)e.uncompressed_size, (size_t)1 << e.frame_size_log2);
+            if (stored_size / sizeof(ulong) < 2 || frames > stored_size / sizeof(ulong) - 2)
+                throw runtime_error("invalid frame index");
+        }
+
+        // The number of frames of the given size in a buffer of the given size
+        static size_t num_frames(size_t total, size_t frame_size) {
+            return total / frame_size + (total % frame_size != 0 ? 1 : 0);
+        }
+
+        ulong read_ulong(const byte* p) const {
+            ulong r;
+            memcpy(&r, p, sizeof(r));
+            if (view.swapped())
+                byte_swap<sizeof(ulong)>(&r, &r, 1);
+            return r;
+        }
+    };
+}
@@ -0,0 +1,234 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    An index of the buffers of a dataset split across many BFAST files (shards). The index maps each buffer name to the shard
+    that holds it, the index of the buffer in the shard, and its ArrayOffset, so that a buffer can be loaded with a single read
+    of the index followed by a single range read of the shard, without opening the other shards.
+
+    The index is itself a BFAST, with the following buffers:
+        bfast:index:shards       The paths of the shards, relative to the directory of the index, each terminated by a null character
+        bfast:index:shard_sizes  The size of each shard when it was indexed, as unsigned 64-bit integers
+        bfast:index:entries      An IndexEntry per buffer of every shard, sorted by the hash of the buffer name
+        bfast:index:names        The names of the buffers, each terminated by a null character, referenced by the entries
+
+    tools/bfast_index.cpp builds an index of a directory and looks up names in it.
+*/
+#pragma once
+
+#include "bfast.h"
+
+namespace bfast
+{
+    // The names of the buffers of an index
+    const char* const index_shards_name = "bfast:index:shards";
+    const char* const index_shard_sizes_name = "bfast:index:shard_sizes";
+    const char* const index_entries_name = "bfast:index:entries";
+    const char* const index_names_name = "bfast:index:names";
+
+    // The location of a named buffer in a shard
+    struct IndexEntry {
+        ulong hash;             // The hash of the name, see index_hash()
+        ulong name;             // The offset of the name in the names buffer of the index
+        uint32_t shard;
+        uint32_t buffer;        // The index of the named buffer in its shard
+        ArrayOffset offset;     // The range of the buffer in its shard
+    };
+
+    // The 64-bit FNV-1a hash of a buffer name, which is stored in the index and so must not change
+    inline constexpr ulong index_hash(string_view name)
+    {
+        ulong h = 14695981039346656037ULL;
+        for (auto c : name) {
+            h ^= (uint8_t)c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // Builds an index of the given shards, whose paths are relative to base_dir, and returns it as a BFAST byte stream.
+    // Only the header, the array offsets and the names of each shard are read.
+    inline vector<byte> build_index(const vector<string>& shards, const string& base_dir = string())
+    {
+        string shard_names;
+        string names;
+        vector<ulong> shard_sizes;
+        vector<IndexEntry> entries;
+        for (size_t s = 0; s < shards.size(); ++s) {
+            auto path = base_dir.empty() ? shards[s] : base_dir + "/" + shards[s];
+            auto source = make_shared<FileSource>(path);
+            BfastLazyReader reader(source);
+            for (size_t i = 0; i < reader.num_buffers(); ++i) {
+                auto name = reader.name(i);
+                entries.push_back({ index_hash(name), (ulong)names.size(), (uint32_t)s, (uint32_t)i, reader.offsets()[i + 1] });
+                names.append(name.data(), name.size());
+                names += '\0';
+            }
+            shard_names += shards[s];
+            shard_names += '\0';
+            shard_sizes.push_back(source->size());
+        }
+        // Buffers with the same name keep the order of the shards
+        stable_sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) { return a.hash < b.hash; });
+
+        BfastData data;
+        data.add(index_shards_name, (byte*)shard_names.data(), (byte*)shard_names.data() + shard_names.size());
+        data.add(index_shard_sizes_name, (byte*)shard_sizes.data(), (byte*)(shard_sizes.data() + shard_sizes.size()));
+        data.add(index_entries_name, (byte*)entries.data(), (byte*)(entries.data() + entries.size()));
+        data.add(index_names_name, (byte*)names.data(), (byte*)names.data() + names.size());
+        return data.pack();
+    }
+
+    // A read-only index of the buffers of a set of shards
+    struct BfastIndex
+    {
+        static const size_t npos = (size_t)-1;
+
+        // Where a buffer is found, shard is npos if it isn't in the index
+        struct Location {
+            size_t shard = npos;
+            size_t buffer = npos;
+            ArrayOffset offset = {};
+            explicit operator bool() const { return shard != npos; }
+        };
+
+        // The BFAST holding the index
+        BfastView view;
+
+        // The directory that the paths of the shards are relative to
+        string base_dir;
+
+        // Creates an index from a BFAST written by build_index(), checking that it has the expected buffers
+        explicit BfastIndex(BfastView index, string base_dir = string())
+            : view(std::move(index)), base_dir(std::move(base_dir))
+        {
+            if (view.swapped())
+                throw runtime_error("the index was written with a different endianness");
+            auto shards = required(index_shards_name);
+            entries = required(index_entries_name).as<IndexEntry>();
+            sizes = required(index_shard_sizes_name).as<ulong>();
+            names = required(index_names_name);
+            auto p = (const char*)shards.begin();
+            auto end = (const char*)shards.end();
+            while (p < end) {
+                auto e = (const char*)memchr(p, '\0', end - p);
+                if (e == nullptr)
+                    throw runtime_error("the shard paths of the index are not terminated");
+                shard_paths.emplace_back(p, e - p);
+                p = e + 1;
+            }
+            if (shard_paths.size() != sizes.size())
+                throw runtime_error("the index does not have a size per shard");
+            for (const auto& entry : entries)
+                if (entry.shard >= shard_paths.size() || entry.name >= names.size())
+                    throw runtime_error("an index entry is out of range");
+            if (names.size() > 0 && names.end()[-1] != 0)
+                throw runtime_error("the names of the index are not terminated");
+        }
+
+        // The number of shards
+        size_t num_shards() const { return shard_paths.size(); }
+
+        // The path of a shard, including the base directory
+        string shard_path(size_t i) const { return base_dir.empty() ? shard_paths[i] : base_dir + "/" + shard_paths[i]; }
+
+        // The size of a shard when it was indexed
+        ulong shard_size(size_t i) const { return sizes[i]; }
+
+        // The entries of the index, sorted by the hash of their name
+        const TypedRange<IndexEntry>& all_entries() const { return entries; }
+
+        // The name of the buffer of an entry
+        string_view name(const IndexEntry& entry) const { return string_view((const char*)names.begin() + entry.name); }
+
+        // Returns the location of the first buffer with the given name, in shard order
+        Location find(string_view name) const {
+            Location r;
+            visit(name, [&](const IndexEntry& e) {
+                r = to_location(e);
+                return false;
+            });
+            return r;
+        }
+
+        // Returns the locations of all buffers with the given name, in shard order
+        vector<Location> find_all(string_view name) const {
+            vector<Location> r;
+            visit(name, [&](const IndexEntry& e) {
+                r.push_back(to_location(e));
+                return true;
+            });
+            return r;
+        }
+
+        // Reads a buffer from its shard with a single range read, checking first that the shard has the size it had when it was indexed
+        AlignedBuffer read(const Location& location) const {
+            if (!location)
+                throw runtime_error("the buffer is not in the index");
+            FileSource file(shard_path(location.shard));
+            if (file.size() != shard_size(location.shard))
+                throw runtime_error("shard " + shard_path(location.shard) + " has changed since it was indexed");
+            AlignedBuffer r((size_t)(location.offset._end - location.offset._begin));
+            file.read(location.offset._begin, r.data(), r.size());
+            return r;
+        }
+
+        // Reads the first buffer with the given name from its shard
+        AlignedBuffer read(string_view name) const {
+            auto location = find(name);
+            if (!location)
+                throw runtime_error("no buffer named " + string(name) + " in the index");
+            return read(location);
+        }
+
+    private:
+        vector<string> shard_paths;
+        TypedRange<ulong> sizes;
+        TypedRange<IndexEntry> entries;
+        ByteRange names = ByteRange(nullptr, nullptr);
+
+        ByteRange required(const char* name) const {
+            auto i = view.find(name);
+            if (i == BfastView::npos)
+                throw runtime_error(string("the index has no buffer named ") + name);
+            return view.buffer(i);
+        }
+
+        Location to_location(const IndexEntry& e) const {
+            Location r;
+            r.shard = e.shard;
+            r.buffer = e.buffer;
+            r.offset = e.offset;
+            return r;
+        }
+
+        // Calls f for each entry with the given name, in shard order, until it returns false
+        template<typename F>
+        void visit(string_view name, F f) const {
+            auto h = index_hash(name);
+            auto it = lower_bound(entries.begin(), entries.end(), h, [](const IndexEntry& e, ulong h) { return e.hash < h; });
+            for (; it != entries.end() && it->hash == h; ++it)
+                if (this->name(*it) == name && !f(*it))
+                    return;
+        }
+    };
+
+    // Memory maps an index file, whose shard paths are relative to the directory that contains it
+    inline BfastIndex open_index(const string& path)
+    {
+        auto slash = path.find_last_of("/\\");
+        return BfastIndex(open_mapped(path), slash == string::npos ? string() : path.substr(0, slash));
+    }
+
+    // Builds an index of the given shards, whose paths are relative to the directory of the index, and writes it to a file
+    inline void write_index(const string& path, const vector<string>& shards)
+    {
+        auto slash = path.find_last_of("/\\");
+        auto bytes = build_index(shards, slash == string::npos ? string() : path.substr(0, slash));
+        auto data = BfastRawData::unpack(bytes);
+        write_file(path, data);
+    }
+}
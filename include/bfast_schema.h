@@ -0,0 +1,158 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Compile-time schemas for containers with a fixed set of buffers. A schema lists the name and element type of each buffer,
+    names are resolved to indices at compile time, and the layout of the header is a constant. For example:
+
+        using Mesh = bfast::schema<bfast::field<"position", float3>, bfast::field<"index", uint32_t>>;
+        auto mesh = Mesh::view(bfast::open_mapped(path));
+        auto indices = mesh.get<"index">();
+
+    Opening a view checks the buffer names once: when the buffers are in schema order no lookup is needed, otherwise each field
+    is found by name. After that, accessing a buffer is an array access. Requires C++20.
+*/
+#pragma once
+
+#include "bfast.h"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace bfast
+{
+    // A string literal that can be used as a template argument
+    template<size_t N>
+    struct fixed_string
+    {
+        char value[N] = {};
+
+        constexpr fixed_string(const char (&s)[N]) {
+            for (size_t i = 0; i < N; ++i)
+                value[i] = s[i];
+        }
+
+        constexpr string_view view() const { return string_view(value, N - 1); }
+    };
+
+    // A named buffer of elements of type T
+    template<fixed_string Name, typename T>
+    struct field
+    {
+        static_assert(is_trivially_copyable_v<T>, "buffer elements must be trivially copyable");
+        static constexpr string_view name = Name.view();
+        typedef T type;
+    };
+
+    template<typename Schema>
+    struct schema_view;
+
+    // A fixed set of named and typed buffers, in the order they are written
+    template<typename... Fields>
+    struct schema
+    {
+        // The number of named buffers
+        static constexpr size_t size = sizeof...(Fields);
+
+        // The names of the buffers, in order
+        static constexpr array<string_view, size> names = { Fields::name... };
+
+        // Where the data starts in a container written with this schema
+        static constexpr size_t data_start = compute_data_start(size + 1);
+
+        // The index of the buffer with the given name, which must be part of the schema
+        template<fixed_string Name>
+        static constexpr size_t index_of() {
+            constexpr auto i = find(Name.view());
+            static_assert(i < size, "the name is not part of the schema");
+            return i;
+        }
+
+        // The element type of the buffer with the given name
+        template<fixed_string Name>
+        using type_of = tuple_element_t<index_of<Name>(), tuple<typename Fields::type...>>;
+
+        // Creates a builder with the buffers of the schema, given the number of elements of each one
+        static BfastBuilder builder(const array<size_t, size>& counts) {
+            BfastBuilder r;
+            constexpr array<size_t, size> element_sizes = { sizeof(typename Fields::type)... };
+            for (size_t i = 0; i < size; ++i)
+                r.add(string(names[i]), counts[i] * element_sizes[i]);
+            return r;
+        }
+
+        // Returns the buffer with the given name of an allocated builder created by builder()
+        template<fixed_string Name>
+        static TypedRange<type_of<Name>> buffer(BfastBuilder& builder) {
+            return builder.buffer_as<type_of<Name>>(index_of<Name>());
+        }
+
+        // Creates a typed view of a BFAST, checking once that it contains the buffers of the schema
+        static schema_view<schema> view(BfastView bfast) { return schema_view<schema>(std::move(bfast)); }
+
+    private:
+        static constexpr size_t find(string_view name) {
+            for (size_t i = 0; i < size; ++i)
+                if (names[i] == name)
+                    return i;
+            return size;
+        }
+    };
+
+    // A view of a BFAST whose buffers follow a schema, with typed accessors that don't look up names
+    template<typename... Fields>
+    struct schema_view<schema<Fields...>>
+    {
+        typedef schema<Fields...> schema_type;
+
+        // The underlying view, which keeps the memory alive
+        BfastView bfast;
+
+        // Checks that every buffer of the schema is present with a size that is a multiple of its element size, and throws an exception otherwise.
+        // The buffers are expected at the index of the schema, and are looked up by name if they aren't there.
+        explicit schema_view(BfastView view)
+            : bfast(std::move(view)), ranges(make_ranges(bfast, index_sequence_for<Fields...>()))
+        { }
+
+        // Returns the elements of the buffer with the given name
+        template<fixed_string Name>
+        const TypedRange<typename schema_type::template type_of<Name>>& get() const {
+            return std::get<schema_type::template index_of<Name>()>(ranges);
+        }
+
+        // Returns the index of the buffer with the given name in the underlying view
+        template<fixed_string Name>
+        size_t index() const { return indices[schema_type::template index_of<Name>()]; }
+
+    private:
+        array<size_t, schema_type::size> indices;
+        tuple<TypedRange<typename Fields::type>...> ranges;
+
+        template<size_t... I>
+        tuple<TypedRange<typename Fields::type>...> make_ranges(const BfastView& view, index_sequence<I...>) {
+            for (size_t i = 0; i < schema_type::size; ++i) {
+                auto name = schema_type::names[i];
+                indices[i] = i < view.num_buffers() && view.name(i) == name ? i : view.find(name);
+                if (indices[i] == BfastView::npos)
+                    throw runtime_error("no buffer named " + string(name));
+            }
+            return tuple<TypedRange<typename Fields::type>...>(typed_buffer<typename Fields::type>(view, indices[I])...);
+        }
+
+        template<typename T>
+        static TypedRange<T> typed_buffer(const BfastView& view, size_t i) {
+            if constexpr (is_arithmetic_v<T>) {
+                return view.native_buffer<T>(i);
+            }
+            else {
+                if (view.swapped() && sizeof(T) > 1)
+                    throw runtime_error("buffers of structures can't be converted from a different endianness");
+                return view.buffer(i).as<T>();
+            }
+        }
+    };
+}
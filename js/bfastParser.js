@@ -11,7 +11,8 @@ function parseBFast( arrayBuffer )
     // Cast the input data to 32-bit integers 
     // Note that according to the spec they are 64 bit numbers. In JavaScript you can't have 64 bit integers, 
     // and it would bust the amount of memory we can work with in most browsers and low-power devices  
-    var data = new Int32Array(arrayBuffer);
+    // The last buffer doesn't have to end on a 4 byte boundary, so only the whole integers are viewed 
+    var data = new Int32Array(arrayBuffer, 0, Math.floor(arrayBuffer.byteLength / 4));
 
     // Parse the header
     var header = {
@@ -27,9 +28,9 @@ function parseBFast( arrayBuffer )
     if (data[3] != 0) throw new Error("Expected 0 in byte position 8");
     if (data[5] != 0) throw new Error("Expected 0 in position 16");
     if (data[7] != 0) throw new Error("Expected 0 in position 24");
-    if (header.DataStart <= 64 || header.DataStart >= arrayBuffer.length) throw new Error("Data start is out of valid range");
-    if (header.DataEnd < header.DataStart || header.DataEnd >= arrayBuffer.length) throw new Error("Data end is out of vaid range");
-    if (header.NumArrays < 0 || header.NumArrays > header.DataEnd) throw new Error("Number of arrays is invalid");
+    if (header.NumArrays < 1 || 32 + header.NumArrays * 16 > header.DataStart) throw new Error("Number of arrays is invalid");
+    if (header.DataStart % 64 != 0 || header.DataStart > arrayBuffer.byteLength) throw new Error("Data start is out of valid range");
+    if (header.DataEnd < header.DataStart || header.DataEnd > arrayBuffer.byteLength) throw new Error("Data end is out of valid range");
             
     // Compute each buffer
     var buffers = [];
@@ -47,11 +48,12 @@ function parseBFast( arrayBuffer )
 
         pos += 4;      
         var buffer = new Uint8Array(arrayBuffer, begin, end - begin);
-        rawBuffers.push(buffer);
+        buffers.push(buffer);
     }
 
-    if (rawBuffers.length < 1) throw new Error("Expected at least one buffer that contains names");
+    // Each name is terminated by a null character, so the last string of the split is empty 
     var names = new TextDecoder("utf-8").decode(buffers[0]).split('\0');
+    names.pop();
     if (names.length != buffers.length - 1) throw new Error("Expected number of names to match number of buffers");
 
     // Return the bfast structure 
@@ -61,3 +63,6 @@ function parseBFast( arrayBuffer )
         buffers: buffers.slice(1),
     }
 };
+
+if (typeof module !== 'undefined')
+    module.exports = parseBFast;
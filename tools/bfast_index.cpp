@@ -0,0 +1,96 @@
+/*
+    BFAST Binary Format for Array Streaming and Transmission
+    Copyright 2019, VIMaec LLC
+    Copyright 2018, Ara 3D, Inc.
+    Usage licensed under terms of MIT License
+    https://github.com/vimaec/bfast
+
+    Builds and queries an index of the buffers of a directory of BFAST files (see bfast_index.h). Build with:
+        g++ -O2 -std=c++17 -I../include bfast_index.cpp -o bfast_index -pthread
+
+    Usage:
+        bfast_index build <directory> [<index>]     Indexes the .bfast files of a directory and its subdirectories,
+                                                    the index is written to <directory>/bfast.index by default
+        bfast_index find <index> <name>...          Prints the shard, buffer index and range of each buffer with the given names
+        bfast_index list <index>                    Prints every entry of the index
+*/
+
+#include "bfast_index.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static void print(const bfast::BfastIndex& index, string_view name, const bfast::BfastIndex::Location& location)
+{
+    printf("%.*s\t%s\t%zu\t%llu\t%llu\n", (int)name.size(), name.data(), index.shard_path(location.shard).c_str(), location.buffer,
+        (unsigned long long)location.offset._begin, (unsigned long long)location.offset._end);
+}
+
+static int build(const string& dir, string path)
+{
+    if (path.empty())
+        path = (fs::path(dir) / "bfast.index").string();
+    auto index_dir = fs::absolute(fs::path(path)).parent_path();
+    vector<string> shards;
+    for (const auto& entry : fs::recursive_directory_iterator(dir))
+        if (entry.is_regular_file() && entry.path().extension() == ".bfast")
+            shards.push_back(fs::relative(fs::absolute(entry.path()), index_dir).generic_string());
+    sort(shards.begin(), shards.end());
+    bfast::write_index(path, shards);
+    auto index = bfast::open_index(path);
+    printf("indexed %zu buffers of %zu shards in %s\n", index.all_entries().size(), index.num_shards(), path.c_str());
+    return 0;
+}
+
+static int find(const string& path, const vector<string>& names)
+{
+    auto index = bfast::open_index(path);
+    int missing = 0;
+    for (const auto& name : names) {
+        auto locations = index.find_all(name);
+        if (locations.empty()) {
+            fprintf(stderr, "%s: not found\n", name.c_str());
+            missing = 1;
+        }
+        for (const auto& location : locations)
+            print(index, name, location);
+    }
+    return missing;
+}
+
+static int list(const string& path)
+{
+    auto index = bfast::open_index(path);
+    for (const auto& entry : index.all_entries()) {
+        bfast::BfastIndex::Location location;
+        location.shard = entry.shard;
+        location.buffer = entry.buffer;
+        location.offset = entry.offset;
+        print(index, index.name(entry), location);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        string command = argc > 1 ? argv[1] : "";
+        if (command == "build" && (argc == 3 || argc == 4))
+            return build(argv[2], argc == 4 ? argv[3] : "");
+        if (command == "find" && argc >= 4)
+            return find(argv[2], vector<string>(argv + 3, argv + argc));
+        if (command == "list" && argc == 3)
+            return list(argv[2]);
+        fprintf(stderr, "usage: bfast_index build <directory> [<index>]\n"
+            "       bfast_index find <index> <name>...\n"
+            "       bfast_index list <index>\n");
+        return 2;
+    }
+    catch (const exception& e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+}